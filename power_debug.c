@@ -13,27 +13,46 @@
 #include <linux/seq_file.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/sort.h>
+#include <linux/suspend.h>
+#include <linux/pm.h>
+#include <linux/bitmap.h>
+#include <linux/firmware.h>
+#include <linux/vmalloc.h>
+#include <linux/sizes.h>
+#include <linux/interrupt.h>
+#include <linux/gpio.h>
+#include <linux/string.h>
+#include <linux/percpu.h>
+#include <linux/syscore_ops.h>
+#include <linux/sched.h>
+
+#include "power_debug.h"
+#include "power_debug_regs.h"
 
 extern void __iomem *GPIOMAPBASE;
 
 #define APQ_NR_GPIOS 150
 #define REG_SIZE 0x1000
+/* size of the TLMM region GPIOMAPBASE maps, all tiles included */
+#define TLMM_SIZE 0xC00000
 #define STATUS_OFFSET 0x10 
 #define APQ_GPIO_CFG(n)       (GPIOMAPBASE + (REG_SIZE * n))
 #define APQ_GPIO_IN_OUT(n)    (GPIOMAPBASE + 4 + (REG_SIZE * n))
+#define APQ_GPIO_INTR_CFG(n)    (GPIOMAPBASE + 8 + (REG_SIZE * n))
+#define APQ_GPIO_INTR_STATUS(n) (GPIOMAPBASE + 0xC + (REG_SIZE * n))
 
+#define APQ_INTR_ENABLE     0x1
+#define APQ_INTR_STATUS     0x1
 
-#define APQ_GPIO_PULL(x)    ((x.ctrl) & 0x3)
-#define APQ_GPIO_FUNC(x)    (((x.ctrl) >> 2) & 0xF)
-#define APQ_GPIO_DRV(x)     (((x.ctrl) >> 6) & 0x7)
-#define APQ_GPIO_OUT_EN(x)  (((x.ctrl) >> 9) & 0x1)
-
-#define APQ_GPIO_IN_VAL(x)  ((x.inout) & 0x1)
-#define APQ_GPIO_OUT_VAL(x) (((x.inout) >> 1) & 0x1)
-
-
-typedef void (*store_func) (struct device * dev, void *data, size_t num);                                                                                                               
-typedef int (*show_func) (struct seq_file * m, void *data, size_t num);
+/* capture cost hints, in microseconds */
+#define APQ_GPIO_COST_US    APQ_NR_GPIOS
+#define SPMI_READ_COST_US   10
 
 static void apq_gpio_store(struct device *dev, void *data, size_t num); 
 static int apq_gpio_show(struct seq_file *m, void *data, size_t num);
@@ -58,6 +77,7 @@ static int pmi8998_ldo_show(struct seq_file *m, void *data, size_t num);
 
 static u32 debug_mask;
 static bool sleep_saved;
+static u32 coalesce_ms;
 static struct dentry *debugfs;
 
 /* APQ GPIO */
@@ -66,13 +86,6 @@ struct apq_gpio {
 	uint32_t inout;
 };
 
-enum gpiomux_pull {
-	GPIOMUX_PULL_NONE = 0,
-	GPIOMUX_PULL_DOWN,
-	GPIOMUX_PULL_KEEPER,
-	GPIOMUX_PULL_UP,
-};
-
 enum {
 	DUMP_APQ_GPIO,
 	DUMP_PM845_GPIO,
@@ -93,11 +106,6 @@ static const char *apq_pull_map[4] = {
 	[GPIOMUX_PULL_UP] = "pu",
 };
 
-struct reg_property {
-	char *regname;
-	int regaddr;
-};
-
 
 struct ldo_property {
 	char *name;
@@ -109,16 +117,23 @@ struct gpio_property {
 	uint8_t Onoff_value;
 };
 
+static u32 apq_gpio_value(void *data, size_t idx)
+{
+	struct apq_gpio *gpios = (struct apq_gpio *)data;
+
+	return APQ_PACK(gpios[idx].ctrl, gpios[idx].inout);
+}
+
+static u32 ldo_value(void *data, size_t idx)
+{
+	return ((struct ldo_property *)data)[idx].Onoff_value;
+}
+
+static u32 gpio_value(void *data, size_t idx)
+{
+	return ((struct gpio_property *)data)[idx].Onoff_value;
+}
 
-struct dump_desc {
-	const char *name;
-	show_func show;
-	store_func store;
-	struct device *dev;
-	size_t item_size;
-	size_t item_count;
-	void *sleep_data;
-};
 
 struct reg_property pm8005_reg_gpio_table[] = {
 	/*pm8005 4 gpios*/
@@ -289,10 +304,51 @@ struct reg_property pm8005_reg_ldo_table[] = {
 
 
 static const u32 sdm845_tile_offsets[] = {0x500000, 0x900000, 0x100000};
-static const unsigned int n_tile_offsets = ARRAY_SIZE(sdm845_tile_offsets);
 
 /*TZ gpio*/
-int gpio_tz[] = {0,1,2,3,81,82,83,84};
+static const u16 gpio_tz[] = {0,1,2,3,81,82,83,84};
+
+/*
+ * Active register map: tile offsets, TZ reserved GPIOs and the register
+ * table of every built-in PMIC target with its capture plan, registers
+ * sorted by SPMI slave and address and merged into burst reads. The
+ * built-in map is made from the tables above; regmap/ loads another.
+ * The map only changes with suspend blocked and targets_lock and
+ * idle_lock held, so every capture path sees a single map.
+ */
+#define PD_MAP_MAX_TILES 8
+#define PD_MAP_MAX_REGS  64
+/* an SPMI extended register read carries at most 8 bytes */
+#define SPMI_MAX_BURST   8
+
+struct pmic_burst {
+	u8 sid;
+	u8 len;
+	u16 addr;
+	u16 first;	/* index into pmic_plan.order */
+};
+
+struct pmic_plan {
+	int nr_bursts;
+	struct pmic_burst bursts[PD_MAP_MAX_REGS];
+	u16 order[PD_MAP_MAX_REGS];
+};
+
+struct pd_regmap {
+	char source[32];
+	u32 nr_tiles;
+	u32 tile_offsets[PD_MAP_MAX_TILES];
+	DECLARE_BITMAP(tz, APQ_NR_GPIOS);
+	u32 tile_base[APQ_NR_GPIOS];	/* resolved before the map is used */
+	struct {
+		size_t nr_regs;
+		struct reg_property regs[PD_MAP_MAX_REGS];
+		char names[PD_MAP_MAX_REGS][PD_MAP_NAME_LEN];
+		struct pmic_plan plan;
+	} tables[DUMP_DEV_NUM];
+};
+
+static struct pd_regmap *pd_map;
 
 /* List of dump targets */
 static struct dump_desc dump_devices[] = {
@@ -303,6 +359,8 @@ static struct dump_desc dump_devices[] = {
 		.dev = NULL,
 		.item_size = sizeof(struct apq_gpio),
 		.item_count = APQ_NR_GPIOS,
+		.cost = APQ_GPIO_COST_US,
+		.value = apq_gpio_value,
 	},
 
 	[DUMP_PM8005_LDO] = {
@@ -313,6 +371,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct ldo_property),
 		.item_count =
 		sizeof(pm8005_reg_ldo_table) / sizeof(pm8005_reg_ldo_table[0]),
+		.cost = ARRAY_SIZE(pm8005_reg_ldo_table) * SPMI_READ_COST_US,
+		.regs = pm8005_reg_ldo_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = ldo_value,
 	}
 	,
 
@@ -324,6 +386,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct gpio_property),
 		.item_count =
 		sizeof(pm8005_reg_gpio_table) / sizeof(pm8005_reg_gpio_table[0]),
+		.cost = ARRAY_SIZE(pm8005_reg_gpio_table) * SPMI_READ_COST_US,
+		.regs = pm8005_reg_gpio_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = gpio_value,
 	}
 	,
 
@@ -335,6 +401,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct ldo_property),
 		.item_count =
 		sizeof(pm845_reg_ldo_table) / sizeof(pm845_reg_ldo_table[0]),
+		.cost = ARRAY_SIZE(pm845_reg_ldo_table) * SPMI_READ_COST_US,
+		.regs = pm845_reg_ldo_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = ldo_value,
 	}
 	,
 
@@ -346,6 +416,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct gpio_property),
 		.item_count =
 		sizeof(pm845_reg_gpio_table) / sizeof(pm845_reg_gpio_table[0]),
+		.cost = ARRAY_SIZE(pm845_reg_gpio_table) * SPMI_READ_COST_US,
+		.regs = pm845_reg_gpio_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = gpio_value,
 	}
 	,
 
@@ -357,6 +431,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct ldo_property),
 		.item_count =
 		sizeof(pmi8998_reg_ldo_table) / sizeof(pmi8998_reg_ldo_table[0]),
+		.cost = ARRAY_SIZE(pmi8998_reg_ldo_table) * SPMI_READ_COST_US,
+		.regs = pmi8998_reg_ldo_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = ldo_value,
 	}
 	,
 
@@ -368,6 +446,10 @@ static struct dump_desc dump_devices[] = {
 		.item_size = sizeof(struct gpio_property),
 		.item_count =
 		sizeof(pmi8998_reg_gpio_table) / sizeof(pmi8998_reg_gpio_table[0]),
+		.cost = ARRAY_SIZE(pmi8998_reg_gpio_table) * SPMI_READ_COST_US,
+		.regs = pmi8998_reg_gpio_table,
+		.item_max = PD_MAP_MAX_REGS,
+		.value = gpio_value,
 	}
 
 	,
@@ -375,20 +457,14 @@ static struct dump_desc dump_devices[] = {
 
 static int tz_ctrl(int num)
 {
-	int i;
-	int size;
-
-	size = sizeof(gpio_tz) / sizeof(gpio_tz[0]);
-	for (i = 0; i < size; i++) {
-		if(num == gpio_tz[i])
-			return 1;
-	}
+	if (num < 0 || num >= APQ_NR_GPIOS)
+		return 0;
 
-	return 0;
+	return test_bit(num, pd_map->tz);
 }
 
 
-static u32 sdm845_pinctrl_find_base(u32 gpio_id)
+static u32 sdm845_pinctrl_find_base(const struct pd_regmap *map, u32 gpio_id)
 {
 	int i;
 	u32 val; 
@@ -396,16 +472,42 @@ static u32 sdm845_pinctrl_find_base(u32 gpio_id)
 	if (gpio_id >= APQ_NR_GPIOS)                                                                                                                        
 		return 0;
 
-	for (i = 0; i < n_tile_offsets; i++) {
-		val = readl_relaxed(APQ_GPIO_CFG(gpio_id)+ sdm845_tile_offsets[i]
+	for (i = 0; i < map->nr_tiles; i++) {
+		val = readl_relaxed(APQ_GPIO_CFG(gpio_id)+ map->tile_offsets[i]
 				+ STATUS_OFFSET);
 		if (val) 
-			return sdm845_tile_offsets[i];
+			return map->tile_offsets[i];
 	}
     					       
 	return 0;
 }
 
+/*
+ * Resolve the tile of every GPIO the map lets us touch. Called before the
+ * map is published, so the capture paths only ever read tile_base.
+ */
+static void regmap_resolve(struct pd_regmap *map)
+{
+	u32 gpio_id;
+
+	for (gpio_id = 0; gpio_id < APQ_NR_GPIOS; gpio_id++) {
+		if (!test_bit(gpio_id, map->tz))
+			map->tile_base[gpio_id] =
+				sdm845_pinctrl_find_base(map, gpio_id);
+	}
+}
+
+static u32 apq_tile_base(u32 gpio_id)
+{
+	return pd_map->tile_base[gpio_id];
+}
+
+static void apq_gpio_read(u32 gpio_id, u32 base, struct apq_gpio *gpio)
+{
+	gpio->ctrl = readl(APQ_GPIO_CFG(gpio_id) + base) & 0x3FF;
+	gpio->inout = readl(APQ_GPIO_IN_OUT(gpio_id) + base) & 0x3;
+}
+
 static void apq_gpio_store(struct device *unused, void *data, size_t num)
 {
 	int gpio_id;
@@ -424,9 +526,8 @@ static void apq_gpio_store(struct device *unused, void *data, size_t num)
 			continue;
 		}		
 
-		base = sdm845_pinctrl_find_base(gpio_id);    
-		gpios[gpio_id].ctrl = readl(APQ_GPIO_CFG(gpio_id) + base) & 0x3FF;
-		gpios[gpio_id].inout = readl((APQ_GPIO_IN_OUT(gpio_id) + base)) & 0x3;
+		base = apq_tile_base(gpio_id);
+		apq_gpio_read(gpio_id, base, &gpios[gpio_id]);
 	}
 }	
 
@@ -464,36 +565,71 @@ static int apq_gpio_show(struct seq_file *m, void *data, size_t num)
 }
 
 extern int read_pmic_data(u8 sid, u16 addr, u8 * buf, int len);
-static void pmi8998_ldo_store(struct device *ssbi_dev, void *data, size_t num)
-{
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
 
-	struct ldo_property *ldo_on_off = (struct ldo_property *)data;
+/*
+ * Failed PMIC reads on this cpu. The idle path can't log with interrupts
+ * off in the deepest cpuidle entry, it accounts the reads that failed
+ * during its capture in idle/stats instead.
+ */
+static DEFINE_PER_CPU(unsigned int, pmic_errors);
+
+/* Read a PMIC target's registers, in table order, through its burst plan */
+static size_t pmic_read(int target, u8 *vals, size_t num)
+{
+	const struct pmic_plan *plan = &pd_map->tables[target].plan;
+	u8 buf[PD_MAP_MAX_REGS];
+	int b, i, ret;
 
-	for (index = 0;
-		 index < (sizeof(pmi8998_reg_ldo_table) / sizeof(struct reg_property));
-		 index++) {
-		sid = (pmi8998_reg_ldo_table[index].regaddr >> 16) & 0xF;
-		addr = pmi8998_reg_ldo_table[index].regaddr & 0xFFFF;
+	num = min(num, pd_map->tables[target].nr_regs);
+	for (b = 0; b < plan->nr_bursts; b++) {
+		const struct pmic_burst *burst = &plan->bursts[b];
 
-		ret = read_pmic_data(sid, addr, buf, 1);
+		ret = read_pmic_data(burst->sid, burst->addr, buf, burst->len);
 		if (ret < 0) {
-			pr_err("SPMI read failed, err = %d\n", ret);
-			goto done;
+			this_cpu_inc(pmic_errors);
+			if (!irqs_disabled())
+				pr_err("SPMI read failed, err = %d\n", ret);
+			return 0;
 		}
 
-		ldo_on_off[index].name = pmi8998_reg_ldo_table[index].regname;
-		ldo_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s ,  ret=%d, value=0x%x\n", __func__, ret, buf[0]);
+		for (i = 0; i < burst->len; i++)
+			vals[plan->order[burst->first + i]] = buf[i];
+	}
+
+	return num;
+}
+
+static void pmic_ldo_store(int target, void *data, size_t num)
+{
+	const struct reg_property *regs = pd_map->tables[target].regs;
+	struct ldo_property *ldo_on_off = (struct ldo_property *)data;
+	u8 vals[PD_MAP_MAX_REGS];
+	size_t i;
+
+	num = pmic_read(target, vals, num);
+	for (i = 0; i < num; i++) {
+		ldo_on_off[i].name = regs[i].regname;
+		ldo_on_off[i].Onoff_value = vals[i];
 	}
+}
+
+static void pmic_gpio_store(int target, void *data, size_t num)
+{
+	const struct reg_property *regs = pd_map->tables[target].regs;
+	struct gpio_property *gpiomap_on_off = (struct gpio_property *)data;
+	u8 vals[PD_MAP_MAX_REGS];
+	size_t i;
 
-done:
-	return;
+	num = pmic_read(target, vals, num);
+	for (i = 0; i < num; i++) {
+		gpiomap_on_off[i].name = regs[i].regname;
+		gpiomap_on_off[i].Onoff_value = vals[i];
+	}
+}
 
+static void pmi8998_ldo_store(struct device *ssbi_dev, void *data, size_t num)
+{
+	pmic_ldo_store(DUMP_PMI8998_LDO, data, num);
 }
 
 static int pmi8998_ldo_show(struct seq_file *m, void *data, size_t num)
@@ -505,7 +641,7 @@ static int pmi8998_ldo_show(struct seq_file *m, void *data, size_t num)
 
 	for (i = 0; i < num; i++) {
 		seq_printf(m, "|%-15s| on_off=0x%x\n", ldo_on_off[i].name,
-			   (ldo_on_off[i].Onoff_value >> 7) & 0x01);
+			   PMIC_EN_BIT(ldo_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-------+-----+----+---+-----------+----+--\n");
@@ -514,33 +650,7 @@ static int pmi8998_ldo_show(struct seq_file *m, void *data, size_t num)
 
 void pmi8998_gpio_store(struct device *dev, void *data, size_t num)
 {
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
-
-	struct gpio_property *gpiomap_on_off = (struct gpio_property *)data;
-
-	for (index = 0;
-		 index < (sizeof(pmi8998_reg_gpio_table) / sizeof(struct reg_property));
-		 index++) {
-		sid = (pmi8998_reg_gpio_table[index].regaddr >> 16) & 0xF;
-		addr = pmi8998_reg_gpio_table[index].regaddr & 0xFFFF;
-
-		ret = read_pmic_data(sid, addr, buf, 1);
-		if (ret < 0) {
-			pr_err("SPMI read failed, err = %d\n", ret);
-			goto done;
-		}
-
-		gpiomap_on_off[index].name = pmi8998_reg_gpio_table[index].regname;
-		gpiomap_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s ,  ret=%d, value=0x%x\n", __func__, ret, buf[0]);
-	}
-
-done:
-	return;
+	pmic_gpio_store(DUMP_PMI8998_GPIO, data, num);
 }
 
 int pmi8998_gpio_show(struct seq_file *m, void *data, size_t num)
@@ -553,14 +663,14 @@ int pmi8998_gpio_show(struct seq_file *m, void *data, size_t num)
 	for (i = 0; i < num / 2; i++) {
 		seq_printf(m, "|%-13s| value=0x%02x | %-7s | %-10s\n", gpiomap_on_off[i].name,
 				   gpiomap_on_off[i].Onoff_value & 0xFF,
-				   (gpiomap_on_off[i].Onoff_value >> 7) == 1 ? "enable" : "disable",
-				   (gpiomap_on_off[i].Onoff_value & 0x01) == 1 ? "input_high" : "input_low"
+				   PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value) ? "enable" : "disable",
+				   PMIC_IN_VAL(gpiomap_on_off[i].Onoff_value) ? "input_high" : "input_low"
 				   );
 	}
 
 	for (i = num / 2; i < num; i++) {
 		seq_printf(m, "|%-13s| invert=%d\n", gpiomap_on_off[i].name,
-				gpiomap_on_off[i].Onoff_value >> 7);
+				PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-----------+-----+----+---+-----------+----+--\n");
@@ -569,33 +679,7 @@ int pmi8998_gpio_show(struct seq_file *m, void *data, size_t num)
 
 static void pm8005_ldo_store(struct device *ssbi_dev, void *data, size_t num)
 {
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
-
-	struct ldo_property *ldo_on_off = (struct ldo_property *)data;
-	
-	for (index = 0;
-		 index < (sizeof(pm8005_reg_ldo_table) / sizeof(struct reg_property));
-		 index++) {
-		sid = (pm8005_reg_ldo_table[index].regaddr >> 16) & 0xF;
-		addr = pm8005_reg_ldo_table[index].regaddr & 0xFFFF;
-
-		ret = read_pmic_data(sid, addr, buf, 1);
-		if (ret < 0) {
-			pr_err("SPMI read failed, err = %d\n", ret);
-			goto done;
-		}
-		ldo_on_off[index].name = pm8005_reg_ldo_table[index].regname;
-		ldo_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s ,  ret=%d, value=0x%x\n", __func__, ret, buf[0]);
-	}
-
-done:
-	return;
-
+	pmic_ldo_store(DUMP_PM8005_LDO, data, num);
 }
 
 static int pm8005_ldo_show(struct seq_file *m, void *data, size_t num)
@@ -607,7 +691,7 @@ static int pm8005_ldo_show(struct seq_file *m, void *data, size_t num)
 
 	for (i = 0; i < num; i++) {
 		seq_printf(m, "|%-15s| on_off=0x%x\n", ldo_on_off[i].name,
-			   (ldo_on_off[i].Onoff_value >> 7) & 0x01);
+			   PMIC_EN_BIT(ldo_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-------+-----+----+---+-----------+----+--\n");
@@ -616,32 +700,7 @@ static int pm8005_ldo_show(struct seq_file *m, void *data, size_t num)
 
 void pm8005_gpio_store(struct device *dev, void *data, size_t num)
 {
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
-
-	struct gpio_property *gpiomap_on_off = (struct gpio_property *)data;
-
-	for (index = 0;
-		 index < (sizeof(pm8005_reg_gpio_table) / sizeof(struct reg_property));
-		 index++) {
-		sid = (pm8005_reg_gpio_table[index].regaddr >> 16) & 0xF;
-		addr = pm8005_reg_gpio_table[index].regaddr & 0xFFFF;
-
-		ret = read_pmic_data(sid, addr, buf, 1);
-		if (ret < 0) {
-			pr_err("SPMI read failed, err = %d\n", ret);
-			goto done;
-		}
-		gpiomap_on_off[index].name = pm8005_reg_gpio_table[index].regname;
-		gpiomap_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s ,  ret=%d, value=0x%x\n", __func__, ret, buf[0]);
-	}
-
-done:
-	return;
+	pmic_gpio_store(DUMP_PM8005_GPIO, data, num);
 }
 
 int pm8005_gpio_show(struct seq_file *m, void *data, size_t num)
@@ -654,14 +713,14 @@ int pm8005_gpio_show(struct seq_file *m, void *data, size_t num)
 	for (i = 0; i < num / 2; i++) {
 		seq_printf(m, "|%-13s| value=0x%02x | %-7s | %-10s\n", gpiomap_on_off[i].name,
 				   gpiomap_on_off[i].Onoff_value & 0xFF,
-				   (gpiomap_on_off[i].Onoff_value >> 7) == 1 ? "enable" : "disable",
-				   (gpiomap_on_off[i].Onoff_value & 0x01) == 1 ? "input_high" : "input_low"
+				   PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value) ? "enable" : "disable",
+				   PMIC_IN_VAL(gpiomap_on_off[i].Onoff_value) ? "input_high" : "input_low"
 				   );
 	}
 
 	for (i = num / 2; i < num; i++) {
 		seq_printf(m, "|%-13s| invert=%d\n", gpiomap_on_off[i].name,
-				gpiomap_on_off[i].Onoff_value >> 7);
+				PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-----------+-----+----+---+-----------+----+--\n");
@@ -678,7 +737,7 @@ static int pm845_ldo_show(struct seq_file *m, void *data, size_t num)
 
 	for (i = 0; i < num; i++) {
 		seq_printf(m, "|%-15s| on_off=0x%x\n", ldo_on_off[i].name,
-			   (ldo_on_off[i].Onoff_value >> 7) & 0x01);
+			   PMIC_EN_BIT(ldo_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-------+-----+----+---+-----------+----+--\n");
@@ -687,63 +746,12 @@ static int pm845_ldo_show(struct seq_file *m, void *data, size_t num)
 
 static void pm845_ldo_store(struct device *ssbi_dev, void *data, size_t num)
 {
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
-
-	struct ldo_property *ldo_on_off = (struct ldo_property *)data;
-
-	for (index = 0;
-		 index < (sizeof(pm845_reg_ldo_table) / sizeof(struct reg_property));
-		 index++) {
-		sid = (pm845_reg_ldo_table[index].regaddr >> 16) & 0xF;
-		addr = pm845_reg_ldo_table[index].regaddr & 0xFFFF;
-
-		ret = read_pmic_data(sid, addr, buf, 1);
-		if (ret < 0) {
-			pr_err("SPMI read failed, err = %d\n", ret);
-			goto done;
-		}
-		ldo_on_off[index].name = pm845_reg_ldo_table[index].regname;
-		ldo_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s ,  ret=%d, value=0x%x\n", __func__, ret, buf[0]);
-	}
-
-done:
-	return;
-
+	pmic_ldo_store(DUMP_PM845_LDO, data, num);
 }
+
 static void pm845_gpio_store(struct device *dev, void *data, size_t num)
 {
-	int index;
-	uint8_t sid;
-	uint8_t buf[1];
-	uint16_t addr;
-	uint8_t ret;
-
-	struct gpio_property *gpiomap_on_off = (struct gpio_property *)data;
-	for (index = 0 ; 
-		 index < (sizeof(pm845_reg_gpio_table)/sizeof(struct reg_property)); index++)
-	{
-		sid = (pm845_reg_gpio_table[index].regaddr >> 16 &0xF);
-		addr = pm845_reg_gpio_table[index].regaddr & 0xFFFF;
-
-		ret = read_pmic_data(sid,addr,buf,1);
-		if (ret < 0)
-		{
-			pr_err("SPMI read failed,err = %d\n",ret);
-			goto done;
-		}
-		
-		gpiomap_on_off[index].name = pm845_reg_gpio_table[index].regname;
-		gpiomap_on_off[index].Onoff_value = buf[0];
-		pr_debug("%s,ret=%d,value=0x%x\n",__func__,ret,buf[0]);
-	}
-
-done:
-	return;
+	pmic_gpio_store(DUMP_PM845_GPIO, data, num);
 }
 
 static int pm845_gpio_show(struct seq_file *m,void *data,size_t num) 
@@ -755,14 +763,14 @@ static int pm845_gpio_show(struct seq_file *m,void *data,size_t num)
 	for (i = 0; i < num / 2; i++) {
 		seq_printf(m, "|%-13s| value=0x%02x | %-7s | %-10s\n", gpiomap_on_off[i].name,
 				   gpiomap_on_off[i].Onoff_value & 0xFF,
-				   (gpiomap_on_off[i].Onoff_value >> 7) == 1 ? "enable" : "disable",
-				   (gpiomap_on_off[i].Onoff_value & 0x01) == 1 ? "input_high" : "input_low"
+				   PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value) ? "enable" : "disable",
+				   PMIC_IN_VAL(gpiomap_on_off[i].Onoff_value) ? "input_high" : "input_low"
 				   );
 	}
 
 	for (i = num / 2; i < num; i++) {
 		seq_printf(m, "|%-13s| invert=%d\n", gpiomap_on_off[i].name,
-				gpiomap_on_off[i].Onoff_value >> 7);
+				PMIC_EN_BIT(gpiomap_on_off[i].Onoff_value));
 	}
 
 	seq_printf(m, "+--+-----------+-----+----+---+-----------+----+--\n");
@@ -770,34 +778,122 @@ static int pm845_gpio_show(struct seq_file *m,void *data,size_t num)
 }
 
 
-static int dump_current(struct seq_file *m,void *unused)
+static bool sample_fresh(struct sample_cache *cache, u64 arrival_ns)
 {
-	struct dump_desc *dump_device = (struct dump_desc *)m->private;
+	if (!cache->data)
+		return false;
+
+	/* a capture finished while we were waiting on the lock */
+	if (cache->done_ns >= arrival_ns)
+		return true;
+
+	return arrival_ns - cache->done_ns <=
+		(u64)READ_ONCE(coalesce_ms) * NSEC_PER_MSEC;
+}
+
+/*
+ * A read of a sampled file. The arrival time is taken by each read()
+ * from offset 0: seq_read calls show again with a bigger buffer when the
+ * first page overflows, and that retry has to land on the capture the
+ * first call made, while a reader that seeks back to 0 gets a new one.
+ */
+struct sample_req {
 	void *data;
-	
-	data = kcalloc(dump_device->item_count,dump_device->item_size,GFP_KERNEL);
-	if (!data)
-		return -ENOMEM;	
+	u64 arrival_ns;
+	bool retry;
+};
+
+static int sample_open(struct file *file,
+		       int (*show)(struct seq_file *, void *), void *data)
+{
+	struct sample_req *req;
+	int ret;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	req->data = data;
+	ret = single_open(file, show, req);
+	if (ret)
+		kfree(req);
+
+	return ret;
+}
 
-	dump_device->store(dump_device->dev,data,dump_device->item_count);
-	dump_device->show(m,data,dump_device->item_count);
-	kfree(data);
+static ssize_t sample_read(struct file *file, char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct sample_req *req = m->private;
+
+	if (!*ppos) {
+		req->arrival_ns = ktime_get_ns();
+		req->retry = false;
+	}
+
+	return seq_read(file, ubuf, count, ppos);
+}
+
+static int sample_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	kfree(m->private);
+	return single_release(inode, file);
+}
+
+static int dump_current(struct seq_file *m,void *unused)
+{
+	struct sample_req *req = m->private;
+	struct dump_desc *dump_device = (struct dump_desc *)req->data;
+	struct sample_cache *cache = &dump_device->cache;
+
+	mutex_lock(&cache->lock);
+	if (sample_fresh(cache, req->arrival_ns)) {
+		if (!req->retry)
+			cache->coalesced++;
+	} else {
+		if (!cache->data)
+			cache->data = kcalloc(dump_device->item_max,
+					dump_device->item_size, GFP_KERNEL);
+		if (!cache->data) {
+			mutex_unlock(&cache->lock);
+			return -ENOMEM;
+		}
+
+		dump_device->store(dump_device->dev,cache->data,
+				dump_device->item_count);
+		cache->done_ns = ktime_get_ns();
+		cache->hw_captures++;
+	}
+
+	dump_device->show(m,cache->data,dump_device->item_count);
+	mutex_unlock(&cache->lock);
+	req->retry = true;
 	return 0;
 }
 
 static int current_open(struct inode *inode, struct file *file)
 {
-	return single_open(file, dump_current, inode->i_private);
+	return sample_open(file, dump_current, inode->i_private);
 }
 
 static struct file_operations current_fops = {
 	.open = current_open,
-	.read = seq_read,
+	.read = sample_read,
 	.llseek = seq_lseek,
-	.release = seq_release,
+	.release = sample_release,
 };
 
 
+/* Registered dump targets, in ascending cost order */
+static LIST_HEAD(dump_targets);
+static DEFINE_MUTEX(targets_lock);
+static u32 targets_ids;
+static u32 targets_gen;
+
+/* targets_lock keeps regmap_switch() from freeing the names shown */
 static int dump_sleep(struct seq_file *m,void *unused)
 {
 	struct dump_desc *dump_device = (struct dump_desc *)m->private;
@@ -806,16 +902,18 @@ static int dump_sleep(struct seq_file *m,void *unused)
 	pr_debug("%s dump_sleep,sleep_saved=%d, sleep_data=%p\n",__func__,sleep_saved,
 			dump_device->sleep_data);
 
+	mutex_lock(&targets_lock);
 	if (sleep_saved && dump_device->sleep_data)
 	{
 		data = dump_device->sleep_data;
 		dump_device->show(m,data,dump_device->item_count);	
-		return 0;
 	}else
 	{
 		seq_printf(m,"not recorded\n");
-		return 0;
 	}
+	mutex_unlock(&targets_lock);
+
+	return 0;
 }
 
 
@@ -833,108 +931,2815 @@ static const struct file_operations sleep_fops = {
 	.release = seq_release,
 };
 
-static int populate(struct dentry *base,const char *dir,
-							struct dump_desc *dump_device)
+/*
+ * Whole-system snapshot: every selected dump target captured in one pass,
+ * under a single timestamp and generation, into a single allocation.
+ */
+struct pd_snapshot {
+	u64 timestamp_ns;
+	u32 generation;
+	u32 mask;
+	u32 layout;
+	int nr;
+	struct dump_desc *order[POWER_DEBUG_MAX_TARGETS];
+	void *data[POWER_DEBUG_MAX_TARGETS];
+};
+
+static u32 all_mask = ~0U;
+static atomic_t snapshot_generation = ATOMIC_INIT(0);
+
+/*
+ * Bus scheduling key: APQ MMIO first, then the PMIC targets grouped by
+ * SPMI slave id so the controller never switches back to a slave twice.
+ */
+static int dump_bus_key(const struct dump_desc *dump_device)
 {
-	struct dentry *local_base;
-	local_base = debugfs_create_dir(dir,base);
-	if (!local_base)
-		return -ENOMEM;
+	if (!dump_device->regs)
+		return 0;
 
-	if(!debugfs_create_file("current",0444,local_base,(void *)dump_device,&current_fops))
-		return -ENOMEM;
+	return 1 + ((dump_device->regs[0].regaddr >> 16) & 0xF);
+}
 
-	if(!debugfs_create_file("sleep",0444,local_base,(void *)dump_device,&sleep_fops))
-		return -ENOMEM;
+/* Must be called with targets_lock held; the snapshot is valid until
+ * targets_gen changes. */
+static struct pd_snapshot *snapshot_alloc(u32 mask)
+{
+	struct dump_desc *order[POWER_DEBUG_MAX_TARGETS];
+	struct dump_desc *dump_device;
+	struct pd_snapshot *snap;
+	size_t size = sizeof(*snap);
+	int i, nr = 0, key;
+	char *p;
+
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		if (!(mask & BIT(dump_device->id)))
+			continue;
 
-	return 0;
+		key = dump_bus_key(dump_device);
+		for (i = nr; i > 0 && dump_bus_key(order[i - 1]) > key; i--)
+			order[i] = order[i - 1];
+		order[i] = dump_device;
+		nr++;
+		size += ALIGN(dump_device->item_count * dump_device->item_size,
+			      sizeof(long));
+	}
+
+	snap = kzalloc(size, GFP_KERNEL);
+	if (!snap)
+		return NULL;
+
+	snap->mask = mask;
+	snap->layout = targets_gen;
+	snap->nr = nr;
+	p = (char *)(snap + 1);
+	for (i = 0; i < nr; i++) {
+		snap->order[i] = order[i];
+		snap->data[i] = p;
+		p += ALIGN(order[i]->item_count * order[i]->item_size,
+			   sizeof(long));
+	}
+
+	return snap;
 }
 
-static int enable_set(void *data,u64 val)
+static void snapshot_capture(struct pd_snapshot *snap)
 {
 	int i;
-	debug_mask = (u32)val;
-	sleep_saved = false;
 
-	for (i = 0; i < DUMP_DEV_NUM; i++)
-	{
-		struct dump_desc *dump_device = &dump_devices[i];
-		if (val)
-		{
-			if (dump_device->sleep_data)
-				continue;
-			dump_device->sleep_data = kcalloc(dump_device->item_count,
-					dump_device->item_size,GFP_KERNEL);
-			if (!dump_device->sleep_data)
-				return -ENOMEM;
-		}else {
-			kfree(dump_device->sleep_data);
-			dump_device->sleep_data = NULL;
-		}
+	snap->timestamp_ns = ktime_get_ns();
+	for (i = 0; i < snap->nr; i++) {
+		struct dump_desc *dump_device = snap->order[i];
+
+		dump_device->store(dump_device->dev, snap->data[i],
+				   dump_device->item_count);
 	}
+	snap->generation = atomic_inc_return(&snapshot_generation);
+}
 
-	return 0;
+static void snapshot_show(struct seq_file *m, struct pd_snapshot *snap)
+{
+	int i;
+
+	seq_printf(m, "generation=%u timestamp=%llu mask=0x%08x\n",
+		   snap->generation, snap->timestamp_ns, snap->mask);
+
+	for (i = 0; i < snap->nr; i++) {
+		struct dump_desc *dump_device = snap->order[i];
+
+		seq_printf(m, "[%s]\n", dump_device->name);
+		dump_device->show(m, snap->data[i], dump_device->item_count);
+	}
 }
 
-static int enable_get(void *data,u64 *val)
+static struct sample_cache all_cache;
+
+/*
+ * Return the coalesced all/ sample, capturing a new one if it is stale.
+ * Must be called with targets_lock and all_cache.lock held.
+ */
+static struct pd_snapshot *all_sample(u64 arrival_ns, bool retry)
 {
-	*val = (u64)debug_mask;
-	sleep_saved = false;
-	return 0;
+	struct pd_snapshot *snap = all_cache.data;
+	u32 mask = READ_ONCE(all_mask);
+
+	if (snap && (snap->mask != mask || snap->layout != targets_gen)) {
+		kfree(snap);
+		snap = all_cache.data = NULL;
+	}
+
+	if (sample_fresh(&all_cache, arrival_ns)) {
+		if (!retry)
+			all_cache.coalesced++;
+		return snap;
+	}
+
+	if (!snap)
+		snap = all_cache.data = snapshot_alloc(mask);
+	if (!snap)
+		return NULL;
+
+	snapshot_capture(snap);
+	all_cache.done_ns = ktime_get_ns();
+	all_cache.hw_captures++;
+	return snap;
+}
+
+static int dump_all(struct seq_file *m, void *unused)
+{
+	struct sample_req *req = m->private;
+	struct pd_snapshot *snap;
+
+	mutex_lock(&targets_lock);
+	mutex_lock(&all_cache.lock);
+	snap = all_sample(req->arrival_ns, req->retry);
+	if (snap)
+		snapshot_show(m, snap);
+	mutex_unlock(&all_cache.lock);
+	mutex_unlock(&targets_lock);
+	req->retry = true;
+
+	return snap ? 0 : -ENOMEM;
 }
 
+static int all_open(struct inode *inode, struct file *file)
+{
+	return sample_open(file, dump_all, inode->i_private);
+}
 
-DEFINE_SIMPLE_ATTRIBUTE(enable_fops, enable_get, enable_set, "0x%08llx\n");
+static const struct file_operations all_fops = {
+	.open = all_open,
+	.read = sample_read,
+	.llseek = seq_lseek,
+	.release = sample_release,
+};
 
-static int __init power_debug_init(void)
+static int snapshot_bin_kind(struct dump_desc *dump_device)
 {
-	int ret = 0;	
-	int i;
-		
-	debugfs = debugfs_create_dir("power_debug",NULL);
-	if (!debugfs)
-	{
-		pr_err("can't create the debugfs dir power_debug\n");
-		return -ENOMEM;
+	if (!dump_device->value)
+		return 0;
+	if (dump_device == &dump_devices[DUMP_APQ_GPIO])
+		return PD_BIN_APQ;
+	if (dump_device->regs)
+		return PD_BIN_PMIC;
+	return PD_BIN_U32;
+}
+
+/*
+ * Pack a snapshot into the power_debug_regs.h binary format, or only
+ * compute its size when buf is NULL. Targets without a value callback
+ * are left out.
+ */
+static size_t snapshot_pack(struct pd_snapshot *snap, u8 *buf)
+{
+	struct pd_bin_header *hdr = (struct pd_bin_header *)buf;
+	size_t off = sizeof(*hdr);
+	int i, j, kind, nr = 0;
+
+	for (i = 0; i < snap->nr; i++) {
+		struct dump_desc *dump_device = snap->order[i];
+		struct pd_bin_section *sec;
+		u8 *p;
+
+		kind = snapshot_bin_kind(dump_device);
+		if (!kind)
+			continue;
+
+		nr++;
+		if (buf) {
+			sec = (struct pd_bin_section *)(buf + off);
+			memset(sec, 0, sizeof(*sec));
+			sec->kind = kind;
+			sec->id = dump_device->id;
+			sec->count = cpu_to_le16(dump_device->item_count);
+			strncpy(sec->name, dump_device->name, sizeof(sec->name));
+
+			p = buf + off + sizeof(*sec);
+			memset(p, 0, pd_bin_payload_size(kind, dump_device->item_count));
+			for (j = 0; j < dump_device->item_count; j++) {
+				u32 val = dump_device->value(snap->data[i], j);
+
+				if (kind == PD_BIN_APQ)
+					((__le16 *)p)[j] = cpu_to_le16(val);
+				else if (kind == PD_BIN_PMIC)
+					p[j] = val;
+				else
+					((__le32 *)p)[j] = cpu_to_le32(val);
+			}
+		}
+		off += sizeof(*sec) + pd_bin_payload_size(kind, dump_device->item_count);
 	}
-	
 
-    if (!debugfs_create_file("enable",0644,debugfs,NULL,&enable_fops)){
-		ret = -ENOMEM;	
-		goto fail;
-    }
-	
-	for (i = 0; i < DUMP_DEV_NUM; i++)
-	{
-		struct dump_desc *dump_device = &dump_devices[i];
-		ret = populate(debugfs,dump_device->name,dump_device);
-		if (ret)
-			goto fail;					
+	if (buf) {
+		hdr->magic = cpu_to_le32(PD_BIN_MAGIC);
+		hdr->version = cpu_to_le16(PD_BIN_VERSION);
+		hdr->nr_sections = cpu_to_le16(nr);
+		hdr->generation = cpu_to_le32(snap->generation);
+		hdr->size = cpu_to_le32(off);
+		hdr->timestamp_ns = cpu_to_le64(snap->timestamp_ns);
 	}
-	
-	pr_debug("power debug init OK\n");
-	return 0;
 
-fail:
-	debugfs_remove_recursive(debugfs);
-	pr_err("power_debug_init failed\n");
-	return ret;
+	return off;
 }
 
+struct pd_blob {
+	size_t size;
+	u8 data[];
+};
 
-void power_debug_collapse(void)
+static int all_raw_open(struct inode *inode, struct file *file)
 {
-	int i;
+	struct pd_snapshot *snap;
+	struct pd_blob *blob = NULL;
+	u64 arrival_ns = ktime_get_ns();
+	size_t size;
+
+	mutex_lock(&targets_lock);
+	mutex_lock(&all_cache.lock);
+	snap = all_sample(arrival_ns, false);
+	if (snap) {
+		size = snapshot_pack(snap, NULL);
+		blob = kmalloc(sizeof(*blob) + size, GFP_KERNEL);
+		if (blob)
+			blob->size = snapshot_pack(snap, blob->data);
+	}
+	mutex_unlock(&all_cache.lock);
+	mutex_unlock(&targets_lock);
+
+	if (!blob)
+		return -ENOMEM;
+
+	file->private_data = blob;
+	return 0;
+}
+
+static ssize_t all_raw_read(struct file *file, char __user *ubuf,
+			    size_t count, loff_t *ppos)
+{
+	struct pd_blob *blob = file->private_data;
+
+	return simple_read_from_buffer(ubuf, count, ppos, blob->data, blob->size);
+}
+
+static int all_raw_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations all_raw_fops = {
+	.open = all_raw_open,
+	.read = all_raw_read,
+	.llseek = default_llseek,
+	.release = all_raw_release,
+};
+
+static void stats_show_one(struct seq_file *m, const char *name,
+			   struct sample_cache *cache)
+{
+	mutex_lock(&cache->lock);
+	seq_printf(m, "%-14s %12llu %12llu\n", name, cache->hw_captures,
+		   cache->coalesced);
+	mutex_unlock(&cache->lock);
+}
+
+static int dump_stats(struct seq_file *m, void *unused)
+{
+	struct dump_desc *dump_device;
+
+	seq_printf(m, "%-14s %12s %12s\n", "target", "hw_captures", "saved");
+	mutex_lock(&targets_lock);
+	list_for_each_entry(dump_device, &dump_targets, node)
+		stats_show_one(m, dump_device->name, &dump_device->cache);
+	mutex_unlock(&targets_lock);
+	stats_show_one(m, "all", &all_cache);
+
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_stats, inode->i_private);
+}
+
+static const struct file_operations stats_fops = {
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_all(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	mutex_init(&all_cache.lock);
+
+	local_base = debugfs_create_dir("all", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("current", 0444, local_base, NULL, &all_fops))
+		return -ENOMEM;
+
+	if (!debugfs_create_file("raw", 0444, local_base, NULL, &all_raw_fops))
+		return -ENOMEM;
+
+	if (!debugfs_create_x32("mask", 0644, local_base, &all_mask))
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Deepest cpuidle state capture. The idle path never allocates: it fills
+ * the idle_data buffers preallocated through idle/mask, every
+ * idle/every_n entries of a cpu and at most once per idle/interval_ms. idle_lock
+ * also keeps targets from being unlinked under the idle path, which runs
+ * outside an RCU read-side section.
+ */
+static u32 idle_mask;
+static u32 idle_every_n = 1000;
+static u32 idle_interval_ms;
+static DEFINE_RAW_SPINLOCK(idle_lock);
+/* per cpu so the idle entry path never shares a cache line */
+static DEFINE_PER_CPU(unsigned long, idle_entries);
+static atomic_t idle_busy = ATOMIC_INIT(0);
+
+/* protected by idle_lock */
+static struct {
+	u64 captures;
+	u64 read_errors;
+	u64 last_ns;
+	u64 last_cost_ns;
+	u64 max_cost_ns;
+	u64 total_cost_ns;
+} idle_stats;
+
+void power_debug_idle_collapse(void)
+{
+	struct dump_desc *dump_device;
+	u32 every_n = READ_ONCE(idle_every_n);
+	unsigned long entries;
+	unsigned int errors;
+	u64 start, cost;
+
+	if (!READ_ONCE(idle_mask))
+		return;
+
+	entries = this_cpu_inc_return(idle_entries);
+	if (every_n && entries % every_n)
+		return;
+
+	/* another cpu is capturing */
+	if (!raw_spin_trylock(&idle_lock)) {
+		atomic_inc(&idle_busy);
+		return;
+	}
+
+	start = ktime_get_ns();
+	if (idle_stats.captures && start - idle_stats.last_ns <
+	    (u64)READ_ONCE(idle_interval_ms) * NSEC_PER_MSEC)
+		goto out;
+
+	errors = __this_cpu_read(pmic_errors);
+	list_for_each_entry_rcu(dump_device, &dump_targets, node) {
+		if (dump_device->idle_data)
+			dump_device->store(dump_device->dev,
+					   dump_device->idle_data,
+					   dump_device->item_count);
+	}
+
+	cost = ktime_get_ns() - start;
+	idle_stats.read_errors += __this_cpu_read(pmic_errors) - errors;
+	idle_stats.captures++;
+	idle_stats.last_ns = start;
+	idle_stats.last_cost_ns = cost;
+	idle_stats.max_cost_ns = max(idle_stats.max_cost_ns, cost);
+	idle_stats.total_cost_ns += cost;
+out:
+	raw_spin_unlock(&idle_lock);
+}
+EXPORT_SYMBOL(power_debug_idle_collapse);
+
+static int dump_idle(struct seq_file *m, void *unused)
+{
+	struct dump_desc *dump_device = (struct dump_desc *)m->private;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&idle_lock, flags);
+	if (idle_stats.captures && dump_device->idle_data)
+		dump_device->show(m, dump_device->idle_data,
+				  dump_device->item_count);
+	else
+		seq_printf(m, "not recorded\n");
+	raw_spin_unlock_irqrestore(&idle_lock, flags);
+
+	return 0;
+}
+
+static int idle_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_idle, inode->i_private);
+}
+
+static const struct file_operations idle_fops = {
+	.open = idle_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int idle_mask_set(void *data, u64 val)
+{
+	struct dump_desc *dump_device;
+	unsigned long flags;
+	void *buf, *old;
+	int ret = 0;
+
+	mutex_lock(&targets_lock);
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		buf = NULL;
+		if (val & BIT(dump_device->id)) {
+			if (dump_device->idle_data)
+				continue;
+			buf = kcalloc(dump_device->item_max,
+				      dump_device->item_size, GFP_KERNEL);
+			if (!buf) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+
+		raw_spin_lock_irqsave(&idle_lock, flags);
+		old = dump_device->idle_data;
+		dump_device->idle_data = buf;
+		raw_spin_unlock_irqrestore(&idle_lock, flags);
+		kfree(old);
+	}
+
+	raw_spin_lock_irqsave(&idle_lock, flags);
+	memset(&idle_stats, 0, sizeof(idle_stats));
+	raw_spin_unlock_irqrestore(&idle_lock, flags);
+	atomic_set(&idle_busy, 0);
+	WRITE_ONCE(idle_mask, (u32)val);
+	mutex_unlock(&targets_lock);
+
+	return ret;
+}
+
+static int idle_mask_get(void *data, u64 *val)
+{
+	*val = (u64)idle_mask;
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(idle_mask_fops, idle_mask_get, idle_mask_set, "0x%08llx\n");
+
+static int dump_idle_stats(struct seq_file *m, void *unused)
+{
+	unsigned long flags, entries = 0;
+	u64 captures, errors, last, max_cost, total;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		entries += per_cpu(idle_entries, cpu);
+
+	raw_spin_lock_irqsave(&idle_lock, flags);
+	captures = idle_stats.captures;
+	errors = idle_stats.read_errors;
+	last = idle_stats.last_cost_ns;
+	max_cost = idle_stats.max_cost_ns;
+	total = idle_stats.total_cost_ns;
+	raw_spin_unlock_irqrestore(&idle_lock, flags);
+
+	seq_printf(m, "entries=%lu captures=%llu busy=%u read_errors=%llu\n",
+		   entries, captures,
+		   atomic_read(&idle_busy), errors);
+	seq_printf(m, "cost_ns last=%llu max=%llu avg=%llu\n", last, max_cost,
+		   captures ? div64_u64(total, captures) : 0);
+
+	return 0;
+}
+
+static int idle_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_idle_stats, inode->i_private);
+}
+
+static const struct file_operations idle_stats_fops = {
+	.open = idle_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_idle(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	local_base = debugfs_create_dir("idle", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("mask", 0644, local_base, NULL, &idle_mask_fops) ||
+	    !debugfs_create_u32("every_n", 0644, local_base, &idle_every_n) ||
+	    !debugfs_create_u32("interval_ms", 0644, local_base, &idle_interval_ms) ||
+	    !debugfs_create_file("stats", 0444, local_base, NULL, &idle_stats_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Selective query: userspace writes APQ GPIO numbers and PMIC register
+ * names ("REG" or "target:REG") to the query file, later reads capture
+ * only those. The text is compiled into a capture plan sorted by bus,
+ * with APQ tile bases resolved up front; the plan is rebuilt when the set
+ * of registered targets changes.
+ */
+#define QUERY_MAX_ITEMS 256
+
+enum {
+	QUERY_APQ,
+	QUERY_PMIC,
+};
+
+struct query_item {
+	u8 kind;
+	u8 sid;
+	u16 addr;	/* GPIO number or SPMI register */
+	u32 base;	/* APQ tile offset */
+	const char *target;
+	const char *name;
+};
+
+struct query_plan {
+	u32 layout;
+	int nr;
+	struct query_item items[];
+};
+
+static DEFINE_MUTEX(query_lock);
+static char *query_text;
+static struct query_plan *query_plan;
+
+static int query_item_cmp(const void *a, const void *b)
+{
+	const struct query_item *x = a, *y = b;
+
+	if (x->kind != y->kind)
+		return x->kind - y->kind;
+	if (x->sid != y->sid)
+		return x->sid - y->sid;
+	return x->addr - y->addr;
+}
+
+static int query_add_regs(struct query_plan *plan, const char *token)
+{
+	struct dump_desc *dump_device;
+	const char *sep = strchr(token, ':');
+	const char *reg = sep ? sep + 1 : token;
+	int i, found = 0;
+
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		if (!dump_device->regs)
+			continue;
+		if (sep && (strlen(dump_device->name) != sep - token ||
+			    strncmp(dump_device->name, token, sep - token)))
+			continue;
+
+		for (i = 0; i < dump_device->item_count; i++) {
+			struct query_item *item;
+
+			if (strcmp(dump_device->regs[i].regname, reg))
+				continue;
+			if (plan->nr == QUERY_MAX_ITEMS)
+				return -E2BIG;
+
+			item = &plan->items[plan->nr++];
+			item->kind = QUERY_PMIC;
+			item->sid = (dump_device->regs[i].regaddr >> 16) & 0xF;
+			item->addr = dump_device->regs[i].regaddr & 0xFFFF;
+			item->target = dump_device->name;
+			item->name = dump_device->regs[i].regname;
+			found++;
+		}
+	}
+
+	return found ? 0 : -ENOENT;
+}
+
+/* Must be called with targets_lock and query_lock held */
+static struct query_plan *query_build(const char *text)
+{
+	struct query_plan *plan;
+	char *buf, *cur, *token;
+	unsigned int gpio;
+	int ret = 0;
+
+	plan = kzalloc(sizeof(*plan) +
+		       QUERY_MAX_ITEMS * sizeof(struct query_item), GFP_KERNEL);
+	buf = kstrdup(text, GFP_KERNEL);
+	if (!plan || !buf) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	cur = buf;
+	while ((token = strsep(&cur, " ,\t\n")) != NULL) {
+		if (!*token)
+			continue;
+
+		if (kstrtouint(token, 0, &gpio)) {
+			ret = query_add_regs(plan, token);
+			if (ret) {
+				pr_err("power_debug: unknown query item %s\n", token);
+				goto fail;
+			}
+			continue;
+		}
+
+		if (gpio >= APQ_NR_GPIOS) {
+			ret = -EINVAL;
+			goto fail;
+		}
+		if (plan->nr == QUERY_MAX_ITEMS) {
+			ret = -E2BIG;
+			goto fail;
+		}
+
+		plan->items[plan->nr].kind = QUERY_APQ;
+		plan->items[plan->nr].addr = gpio;
+		if (!tz_ctrl(gpio))
+			plan->items[plan->nr].base = apq_tile_base(gpio);
+		plan->nr++;
+	}
+
+	sort(plan->items, plan->nr, sizeof(struct query_item),
+	     query_item_cmp, NULL);
+	plan->layout = targets_gen;
+	kfree(buf);
+	return plan;
+
+fail:
+	kfree(buf);
+	kfree(plan);
+	return ERR_PTR(ret);
+}
+
+static void query_show_item(struct seq_file *m, const struct query_item *item)
+{
+	struct apq_gpio gpio;
+	u8 val;
+	int ret;
+
+	if (item->kind == QUERY_APQ) {
+		if (tz_ctrl(item->addr)) {
+			seq_printf(m, "gpio%03u TZ\n", item->addr);
+			return;
+		}
+
+		apq_gpio_read(item->addr, item->base, &gpio);
+		seq_printf(m, "gpio%03u %-3s val=%u drv=%umA func=%u pull=%s\n",
+			   item->addr,
+			   APQ_GPIO_OUT_EN(gpio) ? "out" : "in",
+			   APQ_GPIO_OUT_EN(gpio) ? APQ_GPIO_OUT_VAL(gpio) :
+			   APQ_GPIO_IN_VAL(gpio),
+			   APQ_GPIO_DRV(gpio) * 2 + 2,
+			   APQ_GPIO_FUNC(gpio),
+			   apq_pull_map[APQ_GPIO_PULL(gpio)]);
+		return;
+	}
+
+	ret = read_pmic_data(item->sid, item->addr, &val, 1);
+	if (ret < 0) {
+		seq_printf(m, "%s:%s read failed, err = %d\n", item->target,
+			   item->name, ret);
+		return;
+	}
+
+	seq_printf(m, "%s:%-16s sid=%u addr=0x%04x value=0x%02x\n",
+		   item->target, item->name, item->sid, item->addr, val);
+}
+
+static int dump_query(struct seq_file *m, void *unused)
+{
+	struct query_plan *plan;
+	int i, ret = 0;
+
+	mutex_lock(&targets_lock);
+	mutex_lock(&query_lock);
+	if (!query_text) {
+		seq_printf(m, "no query\n");
+		goto out;
+	}
+
+	if (!query_plan || query_plan->layout != targets_gen) {
+		plan = query_build(query_text);
+		if (IS_ERR(plan)) {
+			ret = PTR_ERR(plan);
+			goto out;
+		}
+		kfree(query_plan);
+		query_plan = plan;
+	}
+
+	for (i = 0; i < query_plan->nr; i++)
+		query_show_item(m, &query_plan->items[i]);
+out:
+	mutex_unlock(&query_lock);
+	mutex_unlock(&targets_lock);
+	return ret;
+}
+
+static int query_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_query, inode->i_private);
+}
+
+static ssize_t query_write(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct query_plan *plan;
+	char *text;
+
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+
+	text = memdup_user_nul(ubuf, count);
+	if (IS_ERR(text))
+		return PTR_ERR(text);
+
+	mutex_lock(&targets_lock);
+	mutex_lock(&query_lock);
+	plan = query_build(text);
+	if (IS_ERR(plan)) {
+		mutex_unlock(&query_lock);
+		mutex_unlock(&targets_lock);
+		kfree(text);
+		return PTR_ERR(plan);
+	}
+
+	kfree(query_plan);
+	kfree(query_text);
+	query_plan = plan;
+	query_text = text;
+	mutex_unlock(&query_lock);
+	mutex_unlock(&targets_lock);
+
+	return count;
+}
+
+static const struct file_operations query_fops = {
+	.open = query_open,
+	.read = seq_read,
+	.write = query_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Staged suspend timeline. Each enabled stage captures every target into
+ * its own slot of stage_data: PM notifier prepare, the late and noirq
+ * device phases of the power_debug platform device, and
+ * power_debug_collapse(). The slots are reset at the start of each cycle.
+ *
+ * The power_debug device is added at late_initcall, after every device it
+ * could be compared against, so its suspend_late and suspend_noirq
+ * callbacks run first in their phase: the "late" and "noirq" columns show
+ * the state at the start of each phase, before any other driver's
+ * callback for that phase has run.
+ */
+enum {
+	STAGE_PREPARE,
+	STAGE_LATE,
+	STAGE_NOIRQ,
+	STAGE_COLLAPSE,
+	STAGE_NUM
+};
+
+static const char *stage_names[STAGE_NUM] = {
+	[STAGE_PREPARE] = "prepare",
+	[STAGE_LATE] = "late",
+	[STAGE_NOIRQ] = "noirq",
+	[STAGE_COLLAPSE] = "collapse",
+};
+
+static u32 stage_mask;
+static u32 stage_valid;
+static u64 stage_cost_ns[STAGE_NUM];
+
+static void *stage_slot(struct dump_desc *dump_device, void *base, int stage)
+{
+	return base + stage * dump_device->item_max * dump_device->item_size;
+}
+
+static void stage_store(struct dump_desc *dump_device, int stage)
+{
+	void *stage_data = READ_ONCE(dump_device->stage_data);
+
+	if (stage_data)
+		dump_device->store(dump_device->dev,
+				   stage_slot(dump_device, stage_data, stage),
+				   dump_device->item_count);
+}
+
+/* Process context stages; the collapse stage runs from power_debug_collapse() */
+static void stage_capture(int stage)
+{
+	struct dump_desc *dump_device;
+	u64 start;
+
+	if (stage == STAGE_PREPARE)
+		stage_valid = 0;
+
+	if (!(READ_ONCE(stage_mask) & BIT(stage)))
+		return;
+
+	start = ktime_get_ns();
+	mutex_lock(&targets_lock);
+	list_for_each_entry(dump_device, &dump_targets, node)
+		stage_store(dump_device, stage);
+	mutex_unlock(&targets_lock);
+	stage_cost_ns[stage] = ktime_get_ns() - start;
+	stage_valid |= BIT(stage);
+}
+
+/*
+ * Boot time of the current suspend, taken while timekeeping still runs;
+ * power_debug_collapse() comes after syscore_suspend() has stopped it.
+ */
+static u64 suspend_boot_ns;
+
+static int stage_pm_notifier(struct notifier_block *nb, unsigned long event,
+			     void *unused)
+{
+	if (event == PM_SUSPEND_PREPARE) {
+		WRITE_ONCE(suspend_boot_ns, ktime_get_boot_ns());
+		stage_capture(STAGE_PREPARE);
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block stage_pm_nb = {
+	.notifier_call = stage_pm_notifier,
+};
+
+static int stage_suspend_late(struct device *dev)
+{
+	stage_capture(STAGE_LATE);
+	return 0;
+}
+
+static int stage_suspend_noirq(struct device *dev)
+{
+	stage_capture(STAGE_NOIRQ);
+	return 0;
+}
+
+/*
+ * Wake source identification: read the TLMM interrupt status of every
+ * GPIO whose interrupt is enabled, the pending ones are the candidate
+ * wake sources. This has to happen in syscore resume, on the boot cpu
+ * with interrupts still off. The TLMM summary interrupt is chained, so
+ * suspend_device_irqs() never suspends it: it fires as soon as
+ * suspend_enter() enables interrupts again, and the edge/level flow
+ * handlers ack, i.e. clear, INTR_STATUS well before any resume_noirq
+ * callback runs.
+ */
+static bool wake_enable;
+static bool wake_registered;
+static DEFINE_SPINLOCK(wake_lock);
+static DECLARE_BITMAP(wake_pending, APQ_NR_GPIOS);
+static u32 wake_count[APQ_NR_GPIOS];
+static u64 wake_cycles;
+static u64 wake_unknown;
+static u64 wake_ns;
+static u64 wake_cost_ns;
+
+static void wake_scan(void)
+{
+	DECLARE_BITMAP(pending, APQ_NR_GPIOS);
+	unsigned long flags;
+	u64 start = ktime_get_ns();
+	u32 gpio_id, base;
+
+	bitmap_zero(pending, APQ_NR_GPIOS);
+	for (gpio_id = 0; gpio_id < APQ_NR_GPIOS; gpio_id++) {
+		if (tz_ctrl(gpio_id))
+			continue;
+
+		base = apq_tile_base(gpio_id);
+		if (!(readl_relaxed(APQ_GPIO_INTR_CFG(gpio_id) + base) &
+		      APQ_INTR_ENABLE))
+			continue;
+
+		if (readl_relaxed(APQ_GPIO_INTR_STATUS(gpio_id) + base) &
+		    APQ_INTR_STATUS)
+			__set_bit(gpio_id, pending);
+	}
+
+	spin_lock_irqsave(&wake_lock, flags);
+	bitmap_copy(wake_pending, pending, APQ_NR_GPIOS);
+	for_each_set_bit(gpio_id, pending, APQ_NR_GPIOS)
+		wake_count[gpio_id]++;
+	if (bitmap_empty(pending, APQ_NR_GPIOS))
+		wake_unknown++;
+	wake_cycles++;
+	wake_ns = start;
+	wake_cost_ns = ktime_get_ns() - start;
+	spin_unlock_irqrestore(&wake_lock, flags);
+}
+
+static void wake_syscore_resume(void)
+{
+	if (READ_ONCE(wake_enable))
+		wake_scan();
+}
+
+static struct syscore_ops wake_syscore_ops = {
+	.resume = wake_syscore_resume,
+};
+
+static const struct dev_pm_ops stage_pm_ops = {
+	.suspend_late = stage_suspend_late,
+	.suspend_noirq = stage_suspend_noirq,
+};
+
+static struct platform_driver stage_driver = {
+	.driver = {
+		.name = "power_debug",
+		.pm = &stage_pm_ops,
+	},
+};
+
+static struct platform_device *stage_pdev;
+
+static int stage_mask_set(void *data, u64 val)
+{
+	struct dump_desc *dump_device;
+	void *old;
+	int ret = 0;
+
+	mutex_lock(&targets_lock);
+	stage_valid = 0;
+	WRITE_ONCE(stage_mask, (u32)val & (BIT(STAGE_NUM) - 1));
+
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		if (stage_mask) {
+			if (dump_device->stage_data)
+				continue;
+			dump_device->stage_data = kcalloc(STAGE_NUM *
+					dump_device->item_max,
+					dump_device->item_size, GFP_KERNEL);
+			if (!dump_device->stage_data) {
+				ret = -ENOMEM;
+				break;
+			}
+		} else if (dump_device->stage_data) {
+			old = dump_device->stage_data;
+			WRITE_ONCE(dump_device->stage_data, NULL);
+			/* power_debug_collapse() may still be filling it */
+			synchronize_rcu();
+			kfree(old);
+		}
+	}
+	mutex_unlock(&targets_lock);
+
+	return ret;
+}
+
+static int stage_mask_get(void *data, u64 *val)
+{
+	*val = (u64)stage_mask;
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(stage_mask_fops, stage_mask_get, stage_mask_set, "0x%llx\n");
+
+static int dump_stage_cost(struct seq_file *m, void *unused)
+{
+	int stage;
+
+	for (stage = 0; stage < STAGE_NUM; stage++) {
+		if (stage_valid & BIT(stage))
+			seq_printf(m, "%-9s %llu ns\n", stage_names[stage],
+				   stage_cost_ns[stage]);
+		else
+			seq_printf(m, "%-9s -\n", stage_names[stage]);
+	}
+
+	return 0;
+}
+
+static int stage_cost_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_stage_cost, inode->i_private);
+}
+
+static const struct file_operations stage_cost_fops = {
+	.open = stage_cost_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int dump_timeline(struct seq_file *m, void *unused)
+{
+	struct dump_desc *dump_device = (struct dump_desc *)m->private;
+	size_t size = dump_device->item_size;
+	void *slot, *prev;
+	u32 valid;
+	int i, stage;
+
+	mutex_lock(&targets_lock);
+	valid = stage_valid;
+	if (!valid || !dump_device->stage_data) {
+		seq_printf(m, "not recorded\n");
+		goto out;
+	}
+
+	seq_printf(m, "%-16s", "item");
+	for (stage = 0; stage < STAGE_NUM; stage++)
+		seq_printf(m, " %-9s", stage_names[stage]);
+	seq_printf(m, " changed\n");
+
+	for (i = 0; i < dump_device->item_count; i++) {
+		if (dump_device->regs)
+			seq_printf(m, "%-16s", dump_device->regs[i].regname);
+		else
+			seq_printf(m, "%-16u", i);
+
+		for (stage = 0; stage < STAGE_NUM; stage++) {
+			slot = stage_slot(dump_device, dump_device->stage_data, stage);
+			if (!(valid & BIT(stage)))
+				seq_printf(m, " %-9s", "-");
+			else if (dump_device->value)
+				seq_printf(m, " 0x%-7x", dump_device->value(slot, i));
+			else
+				seq_printf(m, " %-9s", "raw");
+		}
+
+		/* stages where the item differs from the previous captured one */
+		prev = NULL;
+		seq_printf(m, " ");
+		for (stage = 0; stage < STAGE_NUM; stage++) {
+			if (!(valid & BIT(stage)))
+				continue;
+
+			slot = stage_slot(dump_device, dump_device->stage_data, stage);
+			if (prev && (dump_device->value ?
+			    dump_device->value(prev, i) != dump_device->value(slot, i) :
+			    memcmp(prev + i * size, slot + i * size, size)))
+				seq_printf(m, "%s ", stage_names[stage]);
+			prev = slot;
+		}
+		seq_printf(m, "\n");
+	}
+out:
+	mutex_unlock(&targets_lock);
+	return 0;
+}
+
+static int timeline_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_timeline, inode->i_private);
+}
+
+static const struct file_operations timeline_fops = {
+	.open = timeline_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_stages(struct dentry *base)
+{
+	struct dentry *local_base;
+	int ret;
+
+	local_base = debugfs_create_dir("stages", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("mask", 0644, local_base, NULL, &stage_mask_fops) ||
+	    !debugfs_create_file("cost", 0444, local_base, NULL, &stage_cost_fops))
+		return -ENOMEM;
+
+	ret = platform_driver_register(&stage_driver);
+	if (ret)
+		return ret;
+
+	stage_pdev = platform_device_register_simple("power_debug", -1, NULL, 0);
+	if (IS_ERR(stage_pdev)) {
+		ret = PTR_ERR(stage_pdev);
+		stage_pdev = NULL;
+		platform_driver_unregister(&stage_driver);
+		return ret;
+	}
+
+	ret = register_pm_notifier(&stage_pm_nb);
+	if (ret) {
+		platform_device_unregister(stage_pdev);
+		stage_pdev = NULL;
+		platform_driver_unregister(&stage_driver);
+	}
+
+	return ret;
+}
+
+static void depopulate_stages(void)
+{
+	if (!stage_pdev)
+		return;
+
+	unregister_pm_notifier(&stage_pm_nb);
+	platform_device_unregister(stage_pdev);
+	stage_pdev = NULL;
+	platform_driver_unregister(&stage_driver);
+}
+
+/*
+ * Long-term archive of power_debug_collapse() samples. Each cycle the
+ * register values of all targets are concatenated into one frame: two
+ * bytes of APQ_PACK() per APQ GPIO, one byte per PMIC register, and the
+ * raw items for targets whose value callback we can't invert. The frame
+ * is xored against
+ * the previous frame and run-length coded: a varint n << 1 skips n
+ * unchanged bytes, n << 1 | 1 is followed by n xored bytes, and a trailing
+ * run of unchanged bytes is left out. Every archive/keyframe_interval
+ * records a keyframe is coded against zeroes instead. Records are kept
+ * oldest first in a buffer of archive/budget bytes, and the oldest
+ * keyframe goes together with its deltas when room is needed.
+ *
+ * All buffers are allocated up front, collapse only encodes and copies.
+ * Timekeeping is suspended by then: records carry the boot time taken at
+ * PM_SUSPEND_PREPARE and the encode is timed with local_clock().
+ * The frame layout follows the target list, so it is rebuilt and the
+ * archive emptied whenever targets_gen changes.
+ */
+struct arch_rec {
+	u16 len;
+	u8 key;
+	u8 reserved;
+	u32 time_s;
+};
+
+static u32 arch_budget;
+static u32 arch_key_interval = 256;
+static u32 arch_select;
+static DEFINE_RAW_SPINLOCK(arch_lock);
+
+/* protected by arch_lock */
+static struct {
+	u8 *buf;
+	u32 budget;
+	u32 used;
+	u8 *prev;
+	u8 *cur;
+	u8 *scratch;
+	size_t frame_size;
+	u32 gen;
+	u32 first_seq;
+	u32 next_seq;
+	u32 since_key;
+	u64 evicted;
+	u64 dropped;
+	u64 last_cost_ns;
+} arch;
+
+enum {
+	ARCH_RAW,
+	ARCH_APQ,
+	ARCH_LDO,
+	ARCH_GPIO,
+};
+
+static int arch_kind(const struct dump_desc *dump_device)
+{
+	if (dump_device->value == apq_gpio_value)
+		return ARCH_APQ;
+	if (dump_device->value == ldo_value)
+		return ARCH_LDO;
+	if (dump_device->value == gpio_value)
+		return ARCH_GPIO;
+	return ARCH_RAW;
+}
+
+static size_t arch_item_size(const struct dump_desc *dump_device)
+{
+	switch (arch_kind(dump_device)) {
+	case ARCH_APQ:
+		return 2;
+	case ARCH_LDO:
+	case ARCH_GPIO:
+		return 1;
+	default:
+		return dump_device->item_size;
+	}
+}
+
+/* Append the frame bytes of one target */
+static u8 *arch_pack(struct dump_desc *dump_device, const void *data, u8 *p)
+{
+	size_t i;
+	u32 val;
+
+	if (arch_kind(dump_device) == ARCH_RAW) {
+		memcpy(p, data, dump_device->item_count * dump_device->item_size);
+		return p + dump_device->item_count * dump_device->item_size;
+	}
+
+	for (i = 0; i < dump_device->item_count; i++) {
+		val = dump_device->value((void *)data, i);
+		*p++ = val;
+		if (arch_kind(dump_device) == ARCH_APQ)
+			*p++ = val >> 8;
+	}
+
+	return p;
+}
+
+/* Rebuild the items of one target from its frame bytes */
+static const u8 *arch_unpack(struct dump_desc *dump_device, const u8 *p,
+			     void *data)
+{
+	struct apq_gpio *gpios = data;
+	struct ldo_property *ldos = data;
+	struct gpio_property *pmic_gpios = data;
+	size_t i;
+	u32 val;
+
+	for (i = 0; i < dump_device->item_count; i++) {
+		switch (arch_kind(dump_device)) {
+		case ARCH_APQ:
+			val = p[0] | p[1] << 8;
+			gpios[i].ctrl = APQ_PACKED_CTRL(val);
+			gpios[i].inout = APQ_PACKED_INOUT(val);
+			p += 2;
+			break;
+		case ARCH_LDO:
+			ldos[i].name = dump_device->regs[i].regname;
+			ldos[i].Onoff_value = *p++;
+			break;
+		case ARCH_GPIO:
+			pmic_gpios[i].name = dump_device->regs[i].regname;
+			pmic_gpios[i].Onoff_value = *p++;
+			break;
+		default:
+			memcpy(data, p, dump_device->item_count *
+			       dump_device->item_size);
+			return p + dump_device->item_count * dump_device->item_size;
+		}
+	}
+
+	return p;
+}
+
+static u8 *arch_put_varint(u8 *p, u32 v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static const u8 *arch_get_varint(const u8 *p, const u8 *end, u32 *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; p < end && shift < 32; shift += 7) {
+		*v |= (u32)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+	}
+	return NULL;
+}
+
+/* A NULL prev codes a keyframe */
+static size_t arch_encode(const u8 *cur, const u8 *prev, size_t size, u8 *out)
+{
+	u8 *p = out;
+	size_t i = 0, start;
+
+#define ARCH_SAME(j)	(cur[j] == (prev ? prev[j] : 0))
+	while (i < size) {
+		start = i;
+		while (i < size && ARCH_SAME(i))
+			i++;
+		if (i == size)
+			break;
+		if (i > start)
+			p = arch_put_varint(p, (i - start) << 1);
+
+		/* single unchanged bytes are cheaper inside the literal */
+		start = i;
+		while (i < size && (!ARCH_SAME(i) ||
+				    (i + 1 < size && !ARCH_SAME(i + 1))))
+			i++;
+		p = arch_put_varint(p, (i - start) << 1 | 1);
+		for (; start < i; start++)
+			*p++ = cur[start] ^ (prev ? prev[start] : 0);
+	}
+#undef ARCH_SAME
+
+	return p - out;
+}
+
+/* Apply one record to frame, which holds the previous frame */
+static int arch_decode(const u8 *in, size_t len, u8 *frame, size_t size)
+{
+	const u8 *end = in + len;
+	size_t pos = 0;
+	u32 v, n;
+
+	while (in < end) {
+		in = arch_get_varint(in, end, &v);
+		if (!in)
+			return -EINVAL;
+		n = v >> 1;
+		if (n > size - pos)
+			return -EINVAL;
+		if (!(v & 1)) {
+			pos += n;
+			continue;
+		}
+		if (n > end - in)
+			return -EINVAL;
+		while (n--)
+			frame[pos++] ^= *in++;
+	}
+
+	return 0;
+}
+
+/* Worst case is one literal per two changed bytes */
+static size_t arch_scratch_size(size_t frame_size)
+{
+	return frame_size + frame_size / 2 + 16;
+}
+
+/* Drop the oldest keyframe and the deltas that depend on it */
+static void arch_evict_group(void)
+{
+	struct arch_rec rec;
+	u32 off = 0, nr = 0;
+
+	do {
+		memcpy(&rec, arch.buf + off, sizeof(rec));
+		off += sizeof(rec) + rec.len;
+		nr++;
+		if (off >= arch.used)
+			break;
+		memcpy(&rec, arch.buf + off, sizeof(rec));
+	} while (!rec.key);
+
+	memmove(arch.buf, arch.buf + off, arch.used - off);
+	arch.used -= off;
+	arch.first_seq += nr;
+	arch.evicted += nr;
+}
+
+static void archive_collapse(void)
+{
+	struct dump_desc *dump_device;
+	struct arch_rec rec = { };
+	unsigned long flags;
+	size_t len, n;
+	u64 start;
+	u8 *p;
+
+	raw_spin_lock_irqsave(&arch_lock, flags);
+	if (!arch.buf)
+		goto out;
+
+	start = local_clock();
+	if (arch.gen != READ_ONCE(targets_gen)) {
+		arch.dropped++;
+		goto out;
+	}
+
+	p = arch.cur;
+	rcu_read_lock();
+	list_for_each_entry_rcu(dump_device, &dump_targets, node) {
+		n = dump_device->item_count * arch_item_size(dump_device);
+		if (n > arch.cur + arch.frame_size - p)
+			break;
+		if (dump_device->sleep_data) {
+			p = arch_pack(dump_device, dump_device->sleep_data, p);
+		} else {
+			memset(p, 0, n);
+			p += n;
+		}
+	}
+	rcu_read_unlock();
+	if (p != arch.cur + arch.frame_size) {
+		arch.dropped++;
+		goto out;
+	}
+
+	rec.key = !arch.used || arch.since_key + 1 >= READ_ONCE(arch_key_interval);
+	for (;;) {
+		len = arch_encode(arch.cur, rec.key ? NULL : arch.prev,
+				  arch.frame_size, arch.scratch);
+		if (len > U16_MAX || sizeof(rec) + len > arch.budget) {
+			arch.dropped++;
+			goto out;
+		}
+
+		while (arch.used && arch.used + sizeof(rec) + len > arch.budget)
+			arch_evict_group();
+
+		/* the delta lost its keyframe */
+		if (rec.key || arch.used)
+			break;
+		rec.key = 1;
+	}
+
+	rec.len = len;
+	rec.time_s = div_u64(READ_ONCE(suspend_boot_ns), NSEC_PER_SEC);
+	memcpy(arch.buf + arch.used, &rec, sizeof(rec));
+	memcpy(arch.buf + arch.used + sizeof(rec), arch.scratch, len);
+	arch.used += sizeof(rec) + len;
+	arch.since_key = rec.key ? 0 : arch.since_key + 1;
+	arch.next_seq++;
+	swap(arch.prev, arch.cur);
+	arch.last_cost_ns = local_clock() - start;
+out:
+	raw_spin_unlock_irqrestore(&arch_lock, flags);
+}
+
+/*
+ * Empty the archive and size its buffers for the current target list,
+ * called with targets_lock held. Sequence numbers keep counting so a
+ * reset is visible to readers. If the buffers can't be allocated the
+ * archive is disabled.
+ */
+static int archive_relayout(void)
+{
+	struct dump_desc *dump_device;
+	u8 *buf = NULL, *prev = NULL, *cur = NULL, *scratch = NULL;
+	size_t frame_size = 0;
+	unsigned long flags;
+	int ret = 0;
+
+	if (arch_budget) {
+		list_for_each_entry(dump_device, &dump_targets, node)
+			frame_size += dump_device->item_count *
+				      arch_item_size(dump_device);
+
+		buf = vmalloc(arch_budget);
+		prev = vmalloc(frame_size);
+		cur = vmalloc(frame_size);
+		scratch = vmalloc(arch_scratch_size(frame_size));
+		if (!buf || !prev || !cur || !scratch) {
+			/* disable the archive, the old buffers go too */
+			vfree(buf);
+			vfree(prev);
+			vfree(cur);
+			vfree(scratch);
+			buf = prev = cur = scratch = NULL;
+			frame_size = 0;
+			arch_budget = 0;
+			ret = -ENOMEM;
+		}
+	}
+
+	raw_spin_lock_irqsave(&arch_lock, flags);
+	swap(arch.buf, buf);
+	swap(arch.prev, prev);
+	swap(arch.cur, cur);
+	swap(arch.scratch, scratch);
+	arch.budget = arch_budget;
+	arch.frame_size = frame_size;
+	arch.gen = targets_gen;
+	arch.first_seq = arch.next_seq;
+	arch.used = 0;
+	arch.since_key = 0;
+	arch.evicted = 0;
+	arch.dropped = 0;
+	raw_spin_unlock_irqrestore(&arch_lock, flags);
+
+	vfree(buf);
+	vfree(prev);
+	vfree(cur);
+	vfree(scratch);
+
+	return ret;
+}
+
+static int archive_budget_set(void *data, u64 val)
+{
+	int ret;
+
+	if (val > SZ_16M)
+		return -EINVAL;
+
+	mutex_lock(&targets_lock);
+	arch_budget = (u32)val;
+	ret = archive_relayout();
+	mutex_unlock(&targets_lock);
+
+	return ret;
+}
+
+static int archive_budget_get(void *data, u64 *val)
+{
+	*val = (u64)arch_budget;
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(archive_budget_fops, archive_budget_get, archive_budget_set, "%llu\n");
+
+/*
+ * Rebuild record archive/select from its keyframe and print it through
+ * the show callbacks. targets_lock keeps the layout the records were
+ * coded with.
+ */
+static int dump_archive_frame(struct seq_file *m, void *unused)
+{
+	struct dump_desc *dump_device;
+	struct arch_rec rec;
+	u32 seq = READ_ONCE(arch_select), s, first, next, used, off;
+	unsigned long flags;
+	size_t frame_size, items_size = 0;
+	u8 *buf, *frame, *items;
+	const u8 *p;
+	int ret = 0;
+
+	mutex_lock(&targets_lock);
+	raw_spin_lock_irqsave(&arch_lock, flags);
+	first = arch.first_seq;
+	next = arch.next_seq;
+	used = arch.used;
+	frame_size = arch.frame_size;
+	raw_spin_unlock_irqrestore(&arch_lock, flags);
+
+	if (seq - first >= next - first) {
+		seq_printf(m, "record %u not archived, have %u-%u\n",
+			   seq, first, next - 1);
+		goto out;
+	}
+
+	list_for_each_entry(dump_device, &dump_targets, node)
+		items_size = max(items_size,
+				 dump_device->item_count * dump_device->item_size);
+
+	buf = vmalloc(used);
+	frame = vzalloc(frame_size);
+	items = vzalloc(items_size);
+	if (!buf || !frame || !items) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	/* collapse may have evicted or appended since, recheck under the lock */
+	raw_spin_lock_irqsave(&arch_lock, flags);
+	if (arch.first_seq != first || arch.used < used) {
+		raw_spin_unlock_irqrestore(&arch_lock, flags);
+		ret = -EAGAIN;
+		goto free;
+	}
+	memcpy(buf, arch.buf, used);
+	raw_spin_unlock_irqrestore(&arch_lock, flags);
+
+	for (s = first, off = 0; off < used; s++) {
+		memcpy(&rec, buf + off, sizeof(rec));
+		if (rec.key)
+			memset(frame, 0, frame_size);
+		ret = arch_decode(buf + off + sizeof(rec), rec.len,
+				  frame, frame_size);
+		if (ret || s == seq)
+			break;
+		off += sizeof(rec) + rec.len;
+	}
+	if (ret)
+		goto free;
+
+	seq_printf(m, "record %u time=%us %s\n", seq, rec.time_s,
+		   rec.key ? "keyframe" : "delta");
+	p = frame;
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		p = arch_unpack(dump_device, p, items);
+		seq_printf(m, "%s:\n", dump_device->name);
+		dump_device->show(m, items, dump_device->item_count);
+	}
+
+free:
+	vfree(items);
+	vfree(frame);
+	vfree(buf);
+out:
+	mutex_unlock(&targets_lock);
+	return ret;
+}
+
+static int archive_frame_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_archive_frame, inode->i_private);
+}
+
+static const struct file_operations archive_frame_fops = {
+	.open = archive_frame_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int dump_archive_stats(struct seq_file *m, void *unused)
+{
+	struct arch_rec rec;
+	unsigned long flags;
+	u32 off, keys = 0, budget, used, first, next;
+	u64 evicted, dropped, cost;
+	size_t frame_size;
+
+	raw_spin_lock_irqsave(&arch_lock, flags);
+	for (off = 0; off < arch.used; off += sizeof(rec) + rec.len) {
+		memcpy(&rec, arch.buf + off, sizeof(rec));
+		keys += rec.key;
+	}
+	budget = arch.budget;
+	used = arch.used;
+	first = arch.first_seq;
+	next = arch.next_seq;
+	frame_size = arch.frame_size;
+	evicted = arch.evicted;
+	dropped = arch.dropped;
+	cost = arch.last_cost_ns;
+	raw_spin_unlock_irqrestore(&arch_lock, flags);
+
+	seq_printf(m, "budget=%u used=%u frame=%zu\n", budget, used, frame_size);
+	seq_printf(m, "records=%u keyframes=%u first=%u last=%u\n",
+		   next - first, keys, first, next - 1);
+	seq_printf(m, "raw=%llu evicted=%llu dropped=%llu cost=%lluns\n",
+		   (u64)(next - first) * frame_size, evicted, dropped, cost);
+
+	return 0;
+}
+
+static int archive_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_archive_stats, inode->i_private);
+}
+
+static const struct file_operations archive_stats_fops = {
+	.open = archive_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_archive(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	local_base = debugfs_create_dir("archive", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("budget", 0644, local_base, NULL, &archive_budget_fops) ||
+	    !debugfs_create_u32("keyframe_interval", 0644, local_base, &arch_key_interval) ||
+	    !debugfs_create_u32("select", 0644, local_base, &arch_select) ||
+	    !debugfs_create_file("frame", 0444, local_base, NULL, &archive_frame_fops) ||
+	    !debugfs_create_file("stats", 0444, local_base, NULL, &archive_stats_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Event-driven capture. Writing a GPIO list to trigger/gpios requests a
+ * both-edge threaded interrupt on each APQ GPIO through the TLMM irqchip
+ * (trigger/chip_base is the gpiolib number of GPIO 0). The hard handler
+ * only timestamps the edge, the thread captures the trigger/mask targets
+ * into the next slot of a ring preallocated under targets_lock, at most
+ * once per trigger/min_interval_ms. The ring is rebuilt whenever
+ * targets_gen changes.
+ *
+ * The interrupts are requested without IRQF_SHARED, so a pin whose
+ * interrupt a driver already owns fails with -EBUSY and the whole write
+ * is undone.
+ */
+#define TRIGGER_RING_SIZE	16
+
+struct trigger_src {
+	int irq;
+	u64 hit_ns;
+};
+
+struct trigger_rec {
+	struct pd_snapshot *snap;
+	u32 gpio;
+	u64 hit_ns;
+	u64 latency_ns;
+};
+
+static u32 trigger_mask = ~0U;
+static u32 trigger_chip_base;
+static u32 trigger_interval_ms = 10;
+static DEFINE_MUTEX(trigger_lock);
+static struct trigger_src trigger_srcs[APQ_NR_GPIOS];
+static DECLARE_BITMAP(trigger_armed, APQ_NR_GPIOS);
+static atomic_t trigger_events = ATOMIC_INIT(0);
+
+/* protected by targets_lock */
+static bool trigger_active;
+static struct trigger_rec trigger_ring[TRIGGER_RING_SIZE];
+static int trigger_head;
+static int trigger_count;
+static struct {
+	u64 captures;
+	u64 suppressed;
+	u64 stale;
+	u64 last_hit_ns;
+	u64 last_latency_ns;
+	u64 max_latency_ns;
+	u64 total_latency_ns;
+} trigger_stats;
+
+static irqreturn_t trigger_hardirq(int irq, void *dev_id)
+{
+	struct trigger_src *src = dev_id;
+
+	src->hit_ns = ktime_get_ns();
+	atomic_inc(&trigger_events);
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t trigger_thread(int irq, void *dev_id)
+{
+	struct trigger_src *src = dev_id;
+	struct trigger_rec *rec;
+	u64 hit_ns = src->hit_ns;
+
+	mutex_lock(&targets_lock);
+	rec = &trigger_ring[trigger_head];
+	if (!rec->snap || rec->snap->layout != targets_gen) {
+		trigger_stats.stale++;
+		goto out;
+	}
+
+	if (trigger_stats.captures && hit_ns - trigger_stats.last_hit_ns <
+	    (u64)READ_ONCE(trigger_interval_ms) * NSEC_PER_MSEC) {
+		trigger_stats.suppressed++;
+		goto out;
+	}
+
+	snapshot_capture(rec->snap);
+	rec->gpio = src - trigger_srcs;
+	rec->hit_ns = hit_ns;
+	rec->latency_ns = ktime_get_ns() - hit_ns;
+
+	trigger_head = (trigger_head + 1) % TRIGGER_RING_SIZE;
+	if (trigger_count < TRIGGER_RING_SIZE)
+		trigger_count++;
+	trigger_stats.captures++;
+	trigger_stats.last_hit_ns = hit_ns;
+	trigger_stats.last_latency_ns = rec->latency_ns;
+	trigger_stats.total_latency_ns += rec->latency_ns;
+	if (rec->latency_ns > trigger_stats.max_latency_ns)
+		trigger_stats.max_latency_ns = rec->latency_ns;
+out:
+	mutex_unlock(&targets_lock);
+	return IRQ_HANDLED;
+}
+
+/* Must be called with targets_lock held */
+static int trigger_relayout(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < TRIGGER_RING_SIZE; i++) {
+		kfree(trigger_ring[i].snap);
+		trigger_ring[i].snap = NULL;
+	}
+	trigger_head = 0;
+	trigger_count = 0;
+	memset(&trigger_stats, 0, sizeof(trigger_stats));
+
+	if (!trigger_active)
+		return 0;
+
+	for (i = 0; i < TRIGGER_RING_SIZE; i++) {
+		trigger_ring[i].snap = snapshot_alloc(trigger_mask);
+		if (!trigger_ring[i].snap)
+			ret = -ENOMEM;
+	}
+
+	return ret;
+}
+
+/* Must be called with trigger_lock held */
+static void trigger_disarm(void)
+{
+	int gpio_id;
+
+	for_each_set_bit(gpio_id, trigger_armed, APQ_NR_GPIOS)
+		free_irq(trigger_srcs[gpio_id].irq, &trigger_srcs[gpio_id]);
+	bitmap_zero(trigger_armed, APQ_NR_GPIOS);
+}
+
+static ssize_t trigger_gpios_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	DECLARE_BITMAP(gpios, APQ_NR_GPIOS);
+	int gpio_id, irq, ret;
+	char *buf;
+
+	if (count > PAGE_SIZE)
+		return -EINVAL;
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+	ret = bitmap_parselist(strim(buf), gpios, APQ_NR_GPIOS);
+	kfree(buf);
+	if (ret)
+		return ret;
+
+	for_each_set_bit(gpio_id, gpios, APQ_NR_GPIOS) {
+		if (tz_ctrl(gpio_id))
+			return -EPERM;
+	}
+
+	mutex_lock(&trigger_lock);
+	trigger_disarm();
+
+	/* the ring has to exist before the first edge */
+	mutex_lock(&targets_lock);
+	trigger_active = !bitmap_empty(gpios, APQ_NR_GPIOS);
+	ret = trigger_relayout();
+	mutex_unlock(&targets_lock);
+	if (ret)
+		goto fail;
+
+	for_each_set_bit(gpio_id, gpios, APQ_NR_GPIOS) {
+		irq = gpio_to_irq(trigger_chip_base + gpio_id);
+		if (irq < 0) {
+			ret = irq;
+			goto fail;
+		}
+
+		ret = request_threaded_irq(irq, trigger_hardirq, trigger_thread,
+				IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING |
+				IRQF_ONESHOT, "power_debug", &trigger_srcs[gpio_id]);
+		if (ret)
+			goto fail;
+		trigger_srcs[gpio_id].irq = irq;
+		set_bit(gpio_id, trigger_armed);
+	}
+	mutex_unlock(&trigger_lock);
+
+	return count;
+
+fail:
+	trigger_disarm();
+	mutex_lock(&targets_lock);
+	trigger_active = false;
+	trigger_relayout();
+	mutex_unlock(&targets_lock);
+	mutex_unlock(&trigger_lock);
+	return ret;
+}
+
+static int dump_trigger_gpios(struct seq_file *m, void *unused)
+{
+	mutex_lock(&trigger_lock);
+	seq_printf(m, "%*pbl\n", APQ_NR_GPIOS, trigger_armed);
+	mutex_unlock(&trigger_lock);
+
+	return 0;
+}
+
+static int trigger_gpios_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_trigger_gpios, inode->i_private);
+}
+
+static const struct file_operations trigger_gpios_fops = {
+	.open = trigger_gpios_open,
+	.read = seq_read,
+	.write = trigger_gpios_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int trigger_mask_set(void *data, u64 val)
+{
+	int ret;
+
+	mutex_lock(&targets_lock);
+	trigger_mask = (u32)val;
+	ret = trigger_relayout();
+	mutex_unlock(&targets_lock);
+
+	return ret;
+}
+
+static int trigger_mask_get(void *data, u64 *val)
+{
+	*val = (u64)trigger_mask;
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(trigger_mask_fops, trigger_mask_get, trigger_mask_set, "0x%08llx\n");
+
+/* Oldest capture first */
+static int dump_trigger_ring(struct seq_file *m, void *unused)
+{
+	struct trigger_rec *rec;
+	int i;
+
+	mutex_lock(&targets_lock);
+	for (i = 0; i < trigger_count; i++) {
+		rec = &trigger_ring[(trigger_head - trigger_count + i +
+				     TRIGGER_RING_SIZE) % TRIGGER_RING_SIZE];
+		seq_printf(m, "gpio%03d hit=%llu start=+%lluns latency=%lluns\n",
+			   rec->gpio, rec->hit_ns,
+			   rec->snap->timestamp_ns - rec->hit_ns,
+			   rec->latency_ns);
+		snapshot_show(m, rec->snap);
+	}
+	mutex_unlock(&targets_lock);
+
+	return 0;
+}
+
+static int trigger_ring_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_trigger_ring, inode->i_private);
+}
+
+static const struct file_operations trigger_ring_fops = {
+	.open = trigger_ring_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int dump_trigger_stats(struct seq_file *m, void *unused)
+{
+	mutex_lock(&targets_lock);
+	seq_printf(m, "events=%d captures=%llu suppressed=%llu stale=%llu\n",
+		   atomic_read(&trigger_events), trigger_stats.captures,
+		   trigger_stats.suppressed, trigger_stats.stale);
+	seq_printf(m, "latency last=%lluns max=%lluns avg=%lluns\n",
+		   trigger_stats.last_latency_ns, trigger_stats.max_latency_ns,
+		   trigger_stats.captures ? div64_u64(trigger_stats.total_latency_ns,
+						      trigger_stats.captures) : 0);
+	mutex_unlock(&targets_lock);
+
+	return 0;
+}
+
+static int trigger_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_trigger_stats, inode->i_private);
+}
+
+static const struct file_operations trigger_stats_fops = {
+	.open = trigger_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_trigger(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	local_base = debugfs_create_dir("trigger", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("gpios", 0644, local_base, NULL, &trigger_gpios_fops) ||
+	    !debugfs_create_file("mask", 0644, local_base, NULL, &trigger_mask_fops) ||
+	    !debugfs_create_u32("chip_base", 0644, local_base, &trigger_chip_base) ||
+	    !debugfs_create_u32("min_interval_ms", 0644, local_base, &trigger_interval_ms) ||
+	    !debugfs_create_file("ring", 0444, local_base, NULL, &trigger_ring_fops) ||
+	    !debugfs_create_file("stats", 0444, local_base, NULL, &trigger_stats_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static const struct {
+	const struct reg_property *regs;
+	size_t nr;
+} regmap_defaults[DUMP_DEV_NUM] = {
+	[DUMP_PM845_GPIO] = { pm845_reg_gpio_table, ARRAY_SIZE(pm845_reg_gpio_table) },
+	[DUMP_PM845_LDO] = { pm845_reg_ldo_table, ARRAY_SIZE(pm845_reg_ldo_table) },
+	[DUMP_PM8005_GPIO] = { pm8005_reg_gpio_table, ARRAY_SIZE(pm8005_reg_gpio_table) },
+	[DUMP_PM8005_LDO] = { pm8005_reg_ldo_table, ARRAY_SIZE(pm8005_reg_ldo_table) },
+	[DUMP_PMI8998_GPIO] = { pmi8998_reg_gpio_table, ARRAY_SIZE(pmi8998_reg_gpio_table) },
+	[DUMP_PMI8998_LDO] = { pmi8998_reg_ldo_table, ARRAY_SIZE(pmi8998_reg_ldo_table) },
+};
+
+static void regmap_set_reg(struct pd_regmap *map, int target, int i,
+			   u32 regaddr, const char *name)
+{
+	strlcpy(map->tables[target].names[i], name, PD_MAP_NAME_LEN);
+	map->tables[target].regs[i].regname = map->tables[target].names[i];
+	map->tables[target].regs[i].regaddr = regaddr;
+}
+
+/* Sort a table by slave id and address and merge neighbours into bursts */
+static void regmap_plan(struct pd_regmap *map, int target)
+{
+	const struct reg_property *regs = map->tables[target].regs;
+	struct pmic_plan *plan = &map->tables[target].plan;
+	struct pmic_burst *burst = NULL;
+	size_t nr = map->tables[target].nr_regs;
+	int i, j, key;
+	u8 sid;
+	u16 addr;
+
+	for (i = 0; i < nr; i++) {
+		key = regs[i].regaddr;
+		for (j = i; j > 0 && regs[plan->order[j - 1]].regaddr > key; j--)
+			plan->order[j] = plan->order[j - 1];
+		plan->order[j] = i;
+	}
+
+	plan->nr_bursts = 0;
+	for (i = 0; i < nr; i++) {
+		sid = (regs[plan->order[i]].regaddr >> 16) & 0xF;
+		addr = regs[plan->order[i]].regaddr & 0xFFFF;
+
+		if (burst && burst->sid == sid && burst->addr + burst->len == addr &&
+		    burst->len < SPMI_MAX_BURST) {
+			burst->len++;
+			continue;
+		}
+
+		burst = &plan->bursts[plan->nr_bursts++];
+		burst->sid = sid;
+		burst->addr = addr;
+		burst->len = 1;
+		burst->first = i;
+	}
+}
+
+static struct pd_regmap *regmap_default(void)
+{
+	struct pd_regmap *map;
+	int i, t;
+
+	map = vzalloc(sizeof(*map));
+	if (!map)
+		return NULL;
+
+	strlcpy(map->source, "built-in", sizeof(map->source));
+	map->nr_tiles = ARRAY_SIZE(sdm845_tile_offsets);
+	memcpy(map->tile_offsets, sdm845_tile_offsets, sizeof(sdm845_tile_offsets));
+	for (i = 0; i < ARRAY_SIZE(gpio_tz); i++)
+		__set_bit(gpio_tz[i], map->tz);
+
+	for (t = 0; t < DUMP_DEV_NUM; t++) {
+		if (!regmap_defaults[t].regs)
+			continue;
+
+		map->tables[t].nr_regs = regmap_defaults[t].nr;
+		for (i = 0; i < regmap_defaults[t].nr; i++)
+			regmap_set_reg(map, t, i, regmap_defaults[t].regs[i].regaddr,
+				       regmap_defaults[t].regs[i].regname);
+		regmap_plan(map, t);
+	}
+
+	return map;
+}
+
+static int regmap_find_target(const char *name)
+{
+	int t;
+
+	for (t = 0; t < DUMP_DEV_NUM; t++) {
+		if (regmap_defaults[t].regs && !strcmp(dump_devices[t].name, name))
+			return t;
+	}
+
+	return -ENOENT;
+}
+
+/* Validate a register map blob and build its capture plans */
+static struct pd_regmap *regmap_parse(const u8 *data, size_t size,
+				      const char *source)
+{
+	const struct pd_map_header *hdr = (const struct pd_map_header *)data;
+	const struct pd_map_table *table;
+	const struct pd_map_reg *reg;
+	const __le32 *tiles;
+	const __le16 *tz;
+	struct pd_regmap *map;
+	size_t off, nr_tiles, nr_tz, nr_tables, nr_regs;
+	u32 val;
+	int i, j, t, ret = -EINVAL;
+
+	if (size < sizeof(*hdr) || le32_to_cpu(hdr->magic) != PD_MAP_MAGIC ||
+	    le16_to_cpu(hdr->version) != PD_MAP_VERSION ||
+	    le32_to_cpu(hdr->size) != size)
+		return ERR_PTR(-EINVAL);
+
+	nr_tiles = le16_to_cpu(hdr->nr_tiles);
+	nr_tz = le16_to_cpu(hdr->nr_tz);
+	nr_tables = le16_to_cpu(hdr->nr_tables);
+	off = sizeof(*hdr) + nr_tiles * sizeof(__le32) +
+	      ALIGN(nr_tz * sizeof(__le16), 4);
+	if (!nr_tiles || nr_tiles > PD_MAP_MAX_TILES || nr_tz > APQ_NR_GPIOS ||
+	    off > size)
+		return ERR_PTR(-EINVAL);
+
+	map = regmap_default();
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+	strlcpy(map->source, source, sizeof(map->source));
+
+	tiles = (const __le32 *)(hdr + 1);
+	map->nr_tiles = nr_tiles;
+	for (i = 0; i < nr_tiles; i++) {
+		val = le32_to_cpu(tiles[i]);
+		if (val & (REG_SIZE - 1) ||
+		    val > TLMM_SIZE - APQ_NR_GPIOS * REG_SIZE)
+			goto fail;
+		map->tile_offsets[i] = val;
+	}
+
+	tz = (const __le16 *)(tiles + nr_tiles);
+	bitmap_zero(map->tz, APQ_NR_GPIOS);
+	for (i = 0; i < nr_tz; i++) {
+		val = le16_to_cpu(tz[i]);
+		if (val >= APQ_NR_GPIOS)
+			goto fail;
+		__set_bit(val, map->tz);
+	}
+
+	for (i = 0; i < nr_tables; i++) {
+		if (off + sizeof(*table) > size)
+			goto fail;
+		table = (const struct pd_map_table *)(data + off);
+		off += sizeof(*table);
+
+		if (strnlen(table->target, sizeof(table->target)) ==
+		    sizeof(table->target))
+			goto fail;
+		t = regmap_find_target(table->target);
+		if (t < 0) {
+			pr_err("power_debug: regmap has no target %s\n",
+			       table->target);
+			ret = t;
+			goto fail;
+		}
+
+		nr_regs = le16_to_cpu(table->nr_regs);
+		if (!nr_regs || nr_regs > PD_MAP_MAX_REGS ||
+		    off + nr_regs * sizeof(*reg) > size)
+			goto fail;
+
+		reg = (const struct pd_map_reg *)(data + off);
+		off += nr_regs * sizeof(*reg);
+		for (j = 0; j < nr_regs; j++) {
+			val = le32_to_cpu(reg[j].regaddr);
+			if (val > 0xFFFFF ||
+			    strnlen(reg[j].name, PD_MAP_NAME_LEN) == PD_MAP_NAME_LEN)
+				goto fail;
+			regmap_set_reg(map, t, j, val, reg[j].name);
+		}
+		map->tables[t].nr_regs = nr_regs;
+		regmap_plan(map, t);
+	}
+
+	if (off != size)
+		goto fail;
+
+	return map;
+
+fail:
+	vfree(map);
+	return ERR_PTR(ret);
+}
+
+/* Point the built-in PMIC targets at the tables of map */
+static void regmap_apply(struct pd_regmap *map)
+{
+	int t;
+
+	pd_map = map;
+	for (t = 0; t < DUMP_DEV_NUM; t++) {
+		if (!map->tables[t].nr_regs)
+			continue;
+		dump_devices[t].regs = map->tables[t].regs;
+		dump_devices[t].item_count = map->tables[t].nr_regs;
+	}
+}
+
+/*
+ * Make map the active register map. Suspend is blocked so neither the
+ * suspend stages nor power_debug_collapse() can run with half a switch,
+ * idle_lock keeps the idle path out. Every sample taken with the old map
+ * is dropped, they point at its register names.
+ */
+static void regmap_switch(struct pd_regmap *map)
+{
+	struct dump_desc *dump_device;
+	struct pd_regmap *old;
+	unsigned long flags;
+
+	regmap_resolve(map);
+
+	lock_system_sleep();
+	mutex_lock(&targets_lock);
+	raw_spin_lock_irqsave(&idle_lock, flags);
+	old = pd_map;
+	regmap_apply(map);
+	memset(&idle_stats, 0, sizeof(idle_stats));
+	raw_spin_unlock_irqrestore(&idle_lock, flags);
+
+	sleep_saved = false;
+	stage_valid = 0;
+	targets_gen++;
+	if (archive_relayout())
+		pr_err("power_debug: out of memory, archive disabled\n");
+	trigger_relayout();
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		mutex_lock(&dump_device->cache.lock);
+		kfree(dump_device->cache.data);
+		dump_device->cache.data = NULL;
+		mutex_unlock(&dump_device->cache.lock);
+	}
+	mutex_unlock(&targets_lock);
+	unlock_system_sleep();
+
+	vfree(old);
+}
+
+static ssize_t regmap_load_write(struct file *file, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	const struct firmware *fw;
+	struct pd_regmap *map;
+	char name[64], *fw_name;
+	int ret;
+
+	if (count >= sizeof(name))
+		return -EINVAL;
+	if (copy_from_user(name, ubuf, count))
+		return -EFAULT;
+	name[count] = '\0';
+	fw_name = strim(name);
+
+	if (!strcmp(fw_name, "default")) {
+		map = regmap_default();
+		if (!map)
+			return -ENOMEM;
+	} else {
+		if (!stage_pdev)
+			return -ENODEV;
+
+		ret = request_firmware(&fw, fw_name, &stage_pdev->dev);
+		if (ret)
+			return ret;
+
+		map = regmap_parse(fw->data, fw->size, fw_name);
+		release_firmware(fw);
+		if (IS_ERR(map))
+			return PTR_ERR(map);
+	}
+
+	regmap_switch(map);
+	return count;
+}
+
+static const struct file_operations regmap_load_fops = {
+	.open = simple_open,
+	.write = regmap_load_write,
+	.llseek = default_llseek,
+};
+
+/* The whole blob has to come in a single write */
+static ssize_t regmap_blob_write(struct file *file, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct pd_regmap *map;
+	u8 *blob;
+
+	if (*ppos || count > SZ_64K)
+		return -EINVAL;
+
+	blob = vmalloc(count);
+	if (!blob)
+		return -ENOMEM;
+	if (copy_from_user(blob, ubuf, count)) {
+		vfree(blob);
+		return -EFAULT;
+	}
+
+	map = regmap_parse(blob, count, "debugfs");
+	vfree(blob);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	regmap_switch(map);
+	*ppos += count;
+	return count;
+}
+
+static const struct file_operations regmap_blob_fops = {
+	.open = simple_open,
+	.write = regmap_blob_write,
+	.llseek = default_llseek,
+};
+
+static int dump_regmap(struct seq_file *m, void *unused)
+{
+	int i, t;
+
+	mutex_lock(&targets_lock);
+	seq_printf(m, "source: %s\ntiles:", pd_map->source);
+	for (i = 0; i < pd_map->nr_tiles; i++)
+		seq_printf(m, " 0x%x", pd_map->tile_offsets[i]);
+	seq_printf(m, "\ntz: %*pbl\n", APQ_NR_GPIOS, pd_map->tz);
+
+	for (t = 0; t < DUMP_DEV_NUM; t++) {
+		if (!pd_map->tables[t].nr_regs)
+			continue;
+		seq_printf(m, "%-14s regs=%zu bursts=%d\n", dump_devices[t].name,
+			   pd_map->tables[t].nr_regs,
+			   pd_map->tables[t].plan.nr_bursts);
+	}
+	mutex_unlock(&targets_lock);
+
+	return 0;
+}
+
+static int regmap_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_regmap, inode->i_private);
+}
+
+static const struct file_operations regmap_fops = {
+	.open = regmap_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_regmap(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	local_base = debugfs_create_dir("regmap", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("info", 0444, local_base, NULL, &regmap_fops) ||
+	    !debugfs_create_file("load", 0200, local_base, NULL, &regmap_load_fops) ||
+	    !debugfs_create_file("blob", 0200, local_base, NULL, &regmap_blob_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dump_wake(struct seq_file *m, void *unused)
+{
+	DECLARE_BITMAP(pending, APQ_NR_GPIOS);
+	u32 counts[APQ_NR_GPIOS];
+	u64 cycles, unknown, last, cost;
+	unsigned long flags;
+	int gpio_id;
+
+	spin_lock_irqsave(&wake_lock, flags);
+	bitmap_copy(pending, wake_pending, APQ_NR_GPIOS);
+	memcpy(counts, wake_count, sizeof(counts));
+	cycles = wake_cycles;
+	unknown = wake_unknown;
+	last = wake_ns;
+	cost = wake_cost_ns;
+	spin_unlock_irqrestore(&wake_lock, flags);
+
+	seq_printf(m, "cycles=%llu unknown=%llu\n", cycles, unknown);
+	seq_printf(m, "last=%*pbl timestamp=%llu cost=%lluns\n", APQ_NR_GPIOS,
+		   pending, last, cost);
+	for (gpio_id = 0; gpio_id < APQ_NR_GPIOS; gpio_id++) {
+		if (counts[gpio_id])
+			seq_printf(m, "gpio%03d %u\n", gpio_id, counts[gpio_id]);
+	}
+
+	return 0;
+}
+
+static int wake_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_wake, inode->i_private);
+}
+
+/* Any write clears the wake counts */
+static ssize_t wake_write(struct file *file, const char __user *ubuf,
+			  size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&wake_lock, flags);
+	bitmap_zero(wake_pending, APQ_NR_GPIOS);
+	memset(wake_count, 0, sizeof(wake_count));
+	wake_cycles = 0;
+	wake_unknown = 0;
+	spin_unlock_irqrestore(&wake_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations wake_fops = {
+	.open = wake_open,
+	.read = seq_read,
+	.write = wake_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int populate_wake(struct dentry *base)
+{
+	struct dentry *local_base;
+
+	local_base = debugfs_create_dir("wake", base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if (!debugfs_create_bool("enable", 0644, local_base, &wake_enable) ||
+	    !debugfs_create_file("sources", 0644, local_base, NULL, &wake_fops))
+		return -ENOMEM;
+
+	register_syscore_ops(&wake_syscore_ops);
+	wake_registered = true;
+	return 0;
+}
+
+static void depopulate_wake(void)
+{
+	if (!wake_registered)
+		return;
+
+	unregister_syscore_ops(&wake_syscore_ops);
+	wake_registered = false;
+}
+
+static int populate(struct dentry *base,struct dump_desc *dump_device)
+{
+	struct dentry *local_base;
+	local_base = debugfs_create_dir(dump_device->name,base);
+	if (!local_base)
+		return -ENOMEM;
+
+	if(!debugfs_create_file("current",0444,local_base,(void *)dump_device,&current_fops))
+		goto fail;
+
+	if(!debugfs_create_file("sleep",0444,local_base,(void *)dump_device,&sleep_fops))
+		goto fail;
+
+	if(!debugfs_create_file("idle",0444,local_base,(void *)dump_device,&idle_fops))
+		goto fail;
+
+	if(!debugfs_create_file("timeline",0444,local_base,(void *)dump_device,&timeline_fops))
+		goto fail;
+
+	dump_device->dir = local_base;
+	return 0;
+
+fail:
+	debugfs_remove_recursive(local_base);
+	return -ENOMEM;
+}
+
+static int enable_set(void *data,u64 val)
+{
+	struct dump_desc *dump_device;
+	int ret = 0;
+
+	mutex_lock(&targets_lock);
+	debug_mask = (u32)val;
+	sleep_saved = false;
+
+	list_for_each_entry(dump_device, &dump_targets, node)
+	{
+		if (val)
+		{
+			if (dump_device->sleep_data)
+				continue;
+			dump_device->sleep_data = kcalloc(dump_device->item_max,
+					dump_device->item_size,GFP_KERNEL);
+			if (!dump_device->sleep_data) {
+				ret = -ENOMEM;
+				break;
+			}
+		}else {
+			kfree(dump_device->sleep_data);
+			dump_device->sleep_data = NULL;
+		}
+	}
+	mutex_unlock(&targets_lock);
+
+	return ret;
+}
+
+static int enable_get(void *data,u64 *val)
+{
+	*val = (u64)debug_mask;
+	sleep_saved = false;
+	return 0;
+}
+
+
+DEFINE_SIMPLE_ATTRIBUTE(enable_fops, enable_get, enable_set, "0x%08llx\n");
+
+int power_debug_register(struct dump_desc *dump_device)
+{
+	struct dump_desc *pos;
+	int ret = 0;
+
+	if (!dump_device->name || !dump_device->store || !dump_device->show ||
+	    !dump_device->item_size || !dump_device->item_count)
+		return -EINVAL;
+
+	mutex_lock(&targets_lock);
+	if (targets_ids == ~0U) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	list_for_each_entry(pos, &dump_targets, node) {
+		if (!strcmp(pos->name, dump_device->name)) {
+			ret = -EEXIST;
+			goto out;
+		}
+	}
+
+	memset(&dump_device->cache, 0, sizeof(dump_device->cache));
+	mutex_init(&dump_device->cache.lock);
+	dump_device->dir = NULL;
+	dump_device->sleep_data = NULL;
+	dump_device->idle_data = NULL;
+	dump_device->stage_data = NULL;
+	dump_device->id = ffs(~targets_ids) - 1;
+	if (dump_device->item_max < dump_device->item_count)
+		dump_device->item_max = dump_device->item_count;
+
+	if (debug_mask) {
+		dump_device->sleep_data = kcalloc(dump_device->item_max,
+				dump_device->item_size, GFP_KERNEL);
+		if (!dump_device->sleep_data) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	if (idle_mask & BIT(dump_device->id)) {
+		dump_device->idle_data = kcalloc(dump_device->item_max,
+				dump_device->item_size, GFP_KERNEL);
+		if (!dump_device->idle_data) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	if (stage_mask) {
+		dump_device->stage_data = kcalloc(STAGE_NUM * dump_device->item_max,
+				dump_device->item_size, GFP_KERNEL);
+		if (!dump_device->stage_data) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	/* before power_debug_init() the directory is created there */
+	if (debugfs) {
+		ret = populate(debugfs, dump_device);
+		if (ret)
+			goto fail;
+	}
+
+	targets_ids |= BIT(dump_device->id);
+	targets_gen++;
+
+	list_for_each_entry(pos, &dump_targets, node) {
+		if (pos->cost > dump_device->cost)
+			break;
+	}
+	list_add_tail_rcu(&dump_device->node, &pos->node);
+	if (archive_relayout())
+		pr_err("power_debug: out of memory, archive disabled\n");
+	trigger_relayout();
+	mutex_unlock(&targets_lock);
+	return 0;
+
+fail:
+	kfree(dump_device->sleep_data);
+	dump_device->sleep_data = NULL;
+	kfree(dump_device->idle_data);
+	dump_device->idle_data = NULL;
+	kfree(dump_device->stage_data);
+	dump_device->stage_data = NULL;
+out:
+	mutex_unlock(&targets_lock);
+	return ret;
+}
+EXPORT_SYMBOL(power_debug_register);
+
+void power_debug_unregister(struct dump_desc *dump_device)
+{
+	struct dentry *dir;
+	unsigned long flags;
+
+	mutex_lock(&targets_lock);
+	raw_spin_lock_irqsave(&idle_lock, flags);
+	list_del_rcu(&dump_device->node);
+	raw_spin_unlock_irqrestore(&idle_lock, flags);
+	targets_ids &= ~BIT(dump_device->id);
+	targets_gen++;
+	if (archive_relayout())
+		pr_err("power_debug: out of memory, archive disabled\n");
+	trigger_relayout();
+	dir = dump_device->dir;
+	dump_device->dir = NULL;
+	mutex_unlock(&targets_lock);
+
+	/*
+	 * debugfs removal waits for running readers, and most of them take
+	 * targets_lock.
+	 */
+	debugfs_remove_recursive(dir);
+
+	/* wait for power_debug_collapse() to drop the target */
+	synchronize_rcu();
+
+	kfree(dump_device->sleep_data);
+	dump_device->sleep_data = NULL;
+	kfree(dump_device->idle_data);
+	dump_device->idle_data = NULL;
+	kfree(dump_device->stage_data);
+	dump_device->stage_data = NULL;
+	kfree(dump_device->cache.data);
+	dump_device->cache.data = NULL;
+}
+EXPORT_SYMBOL(power_debug_unregister);
+
+static int __init power_debug_init(void)
+{
+	struct dump_desc *dump_device;
+	struct dentry *dir;
+	int ret = 0;	
+	int i = 0;
+		
+	pd_map = regmap_default();
+	if (!pd_map)
+		return -ENOMEM;
+	regmap_resolve(pd_map);
+	regmap_apply(pd_map);
+
+	debugfs = debugfs_create_dir("power_debug",NULL);
+	if (!debugfs)
+	{
+		pr_err("can't create the debugfs dir power_debug\n");
+		vfree(pd_map);
+		pd_map = NULL;
+		return -ENOMEM;
+	}
+	
+
+    if (!debugfs_create_file("enable",0644,debugfs,NULL,&enable_fops)){
+		ret = -ENOMEM;	
+		goto fail;
+    }
+	
+	if (!debugfs_create_u32("coalesce_ms",0644,debugfs,&coalesce_ms) ||
+	    !debugfs_create_file("stats",0444,debugfs,NULL,&stats_fops) ||
+	    !debugfs_create_file("query",0644,debugfs,NULL,&query_fops)) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	ret = populate_all(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_idle(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_stages(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_regmap(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_wake(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_archive(debugfs);
+	if (ret)
+		goto fail;
+
+	ret = populate_trigger(debugfs);
+	if (ret)
+		goto fail;
+
+	/* targets registered by drivers that initialized before us */
+	mutex_lock(&targets_lock);
+	list_for_each_entry(dump_device, &dump_targets, node) {
+		ret = populate(debugfs, dump_device);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&targets_lock);
+	if (ret)
+		goto fail;
+
+	for (; i < DUMP_DEV_NUM; i++)
+	{
+		ret = power_debug_register(&dump_devices[i]);
+		if (ret)
+			goto fail;					
+	}
+	
+	pr_debug("power debug init OK\n");
+	return 0;
+
+fail:
+	/* the built-in targets point into pd_map */
+	while (i--)
+		power_debug_unregister(&dump_devices[i]);
+	depopulate_wake();
+	depopulate_stages();
+
+	mutex_lock(&targets_lock);
+	dir = debugfs;
+	debugfs = NULL;
+	list_for_each_entry(dump_device, &dump_targets, node)
+		dump_device->dir = NULL;
+	mutex_unlock(&targets_lock);
+	debugfs_remove_recursive(dir);
+
+	vfree(pd_map);
+	pd_map = NULL;
+	pr_err("power_debug_init failed\n");
+	return ret;
+}
+
+
+void power_debug_collapse(void)
+{
+	struct dump_desc *dump_device;
+	u64 start;
+
+	/* timekeeping is suspended by now, only local_clock() still runs */
+	if (READ_ONCE(stage_mask) & BIT(STAGE_COLLAPSE)) {
+		start = local_clock();
+		rcu_read_lock();
+		list_for_each_entry_rcu(dump_device, &dump_targets, node)
+			stage_store(dump_device, STAGE_COLLAPSE);
+		rcu_read_unlock();
+		stage_cost_ns[STAGE_COLLAPSE] = local_clock() - start;
+		stage_valid |= BIT(STAGE_COLLAPSE);
+	}
+
 	if (debug_mask) {
 		pr_debug("%s save sleep state\n", __func__);
-		for (i = 0; i < DUMP_DEV_NUM; i++) {
-			struct dump_desc *dump_device = &dump_devices[i];
+		rcu_read_lock();
+		list_for_each_entry_rcu(dump_device, &dump_targets, node) {
 			if (dump_device->sleep_data)
 				dump_device->store(dump_device->dev,
 				dump_device->sleep_data,
 				dump_device->item_count);
 		}
+		rcu_read_unlock();
 		sleep_saved = true;
+		archive_collapse();
 	}
 }
 
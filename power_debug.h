@@ -0,0 +1,87 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+*/
+
+#ifndef __POWER_DEBUG_H
+#define __POWER_DEBUG_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+
+struct device;
+struct dentry;
+struct seq_file;
+
+#define POWER_DEBUG_MAX_TARGETS 32
+
+typedef void (*store_func) (struct device * dev, void *data, size_t num);
+typedef int (*show_func) (struct seq_file * m, void *data, size_t num);
+typedef u32 (*value_func) (void *data, size_t idx);
+
+struct reg_property {
+	char *regname;
+	int regaddr;
+};
+
+/*
+ * Last hardware sample of a "current" view. Readers that arrive while a
+ * capture is in flight, or within coalesce_ms of the last one, share it.
+ */
+struct sample_cache {
+	struct mutex lock;
+	void *data;
+	u64 done_ns;
+	u64 hw_captures;
+	u64 coalesced;
+};
+
+/*
+ * A dump target. @store captures @item_count items of @item_size bytes
+ * from the hardware, @show renders them. @cost is a capture cost hint in
+ * microseconds; power_debug_collapse() captures the cheapest targets
+ * first. @regs is the PMIC register table, one entry per item, NULL for
+ * MMIO targets.
+ * @value, if set, returns the register value of item @idx for the
+ * suspend timeline; otherwise items are compared byte-wise.
+ * @item_max, when larger than @item_count, is the capacity preallocated
+ * for targets whose item count changes with the register map.
+ *
+ * @store must be atomic. power_debug_collapse() calls it under
+ * rcu_read_lock() and power_debug_idle_collapse() with interrupts off
+ * under a raw spinlock, so it may not sleep, take a mutex or allocate
+ * with GFP_KERNEL; targets behind i2c or a sleeping regmap can't be
+ * registered.
+ *
+ * The fields from @id down belong to power_debug.
+ */
+struct dump_desc {
+	const char *name;
+	show_func show;
+	store_func store;
+	struct device *dev;
+	size_t item_size;
+	size_t item_count;
+	size_t item_max;
+	unsigned int cost;
+	const struct reg_property *regs;
+	value_func value;
+
+	int id;
+	struct list_head node;
+	struct dentry *dir;
+	void *sleep_data;
+	void *idle_data;
+	void *stage_data;
+	struct sample_cache cache;
+};
+
+int power_debug_register(struct dump_desc *dump_device);
+void power_debug_unregister(struct dump_desc *dump_device);
+void power_debug_collapse(void);
+void power_debug_idle_collapse(void);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+*/
+
+/*
+ * Register field decoding and the binary snapshot format, shared by
+ * power_debug.c and the host side tools/pd_decode.c.
+ */
+
+#ifndef __POWER_DEBUG_REGS_H
+#define __POWER_DEBUG_REGS_H
+
+#include <linux/types.h>
+
+/* APQ TLMM GPIO_CFG and GPIO_IN_OUT fields */
+#define APQ_CTRL_PULL(c)       ((c) & 0x3)
+#define APQ_CTRL_FUNC(c)       (((c) >> 2) & 0xF)
+#define APQ_CTRL_DRV(c)        (((c) >> 6) & 0x7)
+#define APQ_CTRL_OUT_EN(c)     (((c) >> 9) & 0x1)
+
+#define APQ_INOUT_IN_VAL(io)   ((io) & 0x1)
+#define APQ_INOUT_OUT_VAL(io)  (((io) >> 1) & 0x1)
+
+#define APQ_GPIO_PULL(x)    APQ_CTRL_PULL((x).ctrl)
+#define APQ_GPIO_FUNC(x)    APQ_CTRL_FUNC((x).ctrl)
+#define APQ_GPIO_DRV(x)     APQ_CTRL_DRV((x).ctrl)
+#define APQ_GPIO_OUT_EN(x)  APQ_CTRL_OUT_EN((x).ctrl)
+
+#define APQ_GPIO_IN_VAL(x)  APQ_INOUT_IN_VAL((x).inout)
+#define APQ_GPIO_OUT_VAL(x) APQ_INOUT_OUT_VAL((x).inout)
+
+/* APQ GPIO packed into 12 bits: GPIO_CFG[9:0], GPIO_IN_OUT[1:0] above it */
+#define APQ_PACK(ctrl, inout)  ((ctrl) | ((inout) << 10))
+#define APQ_PACKED_CTRL(v)     ((v) & 0x3FF)
+#define APQ_PACKED_INOUT(v)    (((v) >> 10) & 0x3)
+
+enum gpiomux_pull {
+	GPIOMUX_PULL_NONE = 0,
+	GPIOMUX_PULL_DOWN,
+	GPIOMUX_PULL_KEEPER,
+	GPIOMUX_PULL_UP,
+};
+
+/*
+ * PMIC registers: bit 7 is the enable bit of EN_CTL and GPIO STATUS and
+ * the invert bit of GPIO DIG_OUT; bit 0 of GPIO STATUS is the input level.
+ */
+#define PMIC_EN_BIT(v)         (((v) >> 7) & 0x1)
+#define PMIC_IN_VAL(v)         ((v) & 0x1)
+
+/*
+ * Binary snapshot, little endian: a pd_bin_header followed by
+ * nr_sections pd_bin_section, each followed by count values padded to
+ * 4 bytes: __le16 APQ_PACK() values for PD_BIN_APQ, one byte per
+ * register for PD_BIN_PMIC, __le32 for PD_BIN_U32. size covers the
+ * whole snapshot so that snapshots can be concatenated. The section name
+ * is only NUL terminated when shorter than 12 characters.
+ */
+#define PD_BIN_MAGIC    0x4E534450	/* "PDSN" */
+#define PD_BIN_VERSION  1
+
+enum {
+	PD_BIN_APQ = 1,
+	PD_BIN_PMIC,
+	PD_BIN_U32,
+};
+
+struct pd_bin_header {
+	__le32 magic;
+	__le16 version;
+	__le16 nr_sections;
+	__le32 generation;
+	__le32 size;
+	__le64 timestamp_ns;
+};
+
+struct pd_bin_section {
+	__u8 kind;
+	__u8 id;
+	__le16 count;
+	char name[12];
+};
+
+static inline unsigned int pd_bin_value_size(unsigned int kind)
+{
+	return kind == PD_BIN_APQ ? 2 : kind == PD_BIN_PMIC ? 1 : 4;
+}
+
+static inline unsigned int pd_bin_payload_size(unsigned int kind,
+					       unsigned int count)
+{
+	return (pd_bin_value_size(kind) * count + 3) & ~3U;
+}
+
+/*
+ * Register map blob, little endian, loaded through power_debug/regmap/:
+ * a pd_map_header, __le32 tile_offsets[nr_tiles], __le16 TZ reserved
+ * GPIOs[nr_tz] padded to 4 bytes, then nr_tables pd_map_table each
+ * followed by nr_regs pd_map_reg. regaddr is SID << 16 | address, names
+ * are NUL terminated. Targets without a table keep their built-in one.
+ */
+#define PD_MAP_MAGIC    0x504D4450	/* "PDMP" */
+#define PD_MAP_VERSION  1
+#define PD_MAP_NAME_LEN 20
+
+struct pd_map_header {
+	__le32 magic;
+	__le16 version;
+	__le16 nr_tiles;
+	__le16 nr_tz;
+	__le16 nr_tables;
+	__le32 size;
+};
+
+struct pd_map_table {
+	char target[16];
+	__le16 nr_regs;
+	__le16 reserved;
+};
+
+struct pd_map_reg {
+	__le32 regaddr;
+	char name[PD_MAP_NAME_LEN];
+};
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+*/
+
+/*
+ * pd_decode - host side decoder for power_debug binary snapshots
+ *
+ *   cc -O3 -march=native -o pd_decode tools/pd_decode.c
+ *
+ *   pd_decode decode FILE...   print every snapshot
+ *   pd_decode stats FILE...    per-item state distribution and change rates
+ *   pd_decode bench [N]        stats throughput over N synthetic snapshots
+ *
+ * FILE holds concatenated reads of power_debug/all/raw and is memory
+ * mapped; "-" streams from stdin. Statistics need every snapshot to have
+ * the layout of the first one, others are counted and skipped.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../power_debug_regs.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "pd_decode reads the little endian snapshot format in place"
+#endif
+
+#define MAX_SECTIONS 32
+#define STREAM_CHUNK (1 << 20)
+
+static const char *apq_pull_map[4] = {
+	[GPIOMUX_PULL_NONE] = "none",
+	[GPIOMUX_PULL_DOWN] = "pd",
+	[GPIOMUX_PULL_KEEPER] = "keeper",
+	[GPIOMUX_PULL_UP] = "pu",
+};
+
+struct section_acc {
+	struct pd_bin_section sec;
+	size_t off;		/* payload offset inside the snapshot */
+	unsigned int count;
+
+	/* PD_BIN_APQ */
+	uint32_t *out_en;
+	uint32_t *high;
+	uint32_t *pull[4];
+	uint32_t *alt_func;
+	/* PD_BIN_PMIC */
+	uint32_t *en;
+	uint32_t *in_high;
+	/* all kinds */
+	uint32_t *chg_prev;
+	uint32_t *chg_ref;
+};
+
+struct analysis {
+	int nr;
+	uint32_t size;
+	struct section_acc acc[MAX_SECTIONS];
+	uint8_t *ref;
+	uint8_t *prev;
+	uint64_t snapshots;
+	uint64_t mismatched;
+	uint64_t invalid;
+};
+
+enum mode {
+	MODE_DECODE,
+	MODE_STATS,
+};
+
+static void *xcalloc(size_t n, size_t size)
+{
+	void *p = calloc(n, size);
+
+	if (!p) {
+		perror("calloc");
+		exit(1);
+	}
+	return p;
+}
+
+/* Returns the snapshot size, or 0 if buf does not start with a valid one */
+static uint32_t snapshot_check(const uint8_t *buf, size_t len)
+{
+	const struct pd_bin_header *hdr = (const void *)buf;
+	size_t off = sizeof(*hdr);
+	unsigned int i;
+
+	if (len < sizeof(*hdr) || hdr->magic != PD_BIN_MAGIC ||
+	    hdr->version != PD_BIN_VERSION || hdr->size < sizeof(*hdr) ||
+	    hdr->size % 4 || hdr->size > len)
+		return 0;
+
+	for (i = 0; i < hdr->nr_sections; i++) {
+		const struct pd_bin_section *sec = (const void *)(buf + off);
+
+		if (off + sizeof(*sec) > hdr->size ||
+		    sec->kind < PD_BIN_APQ || sec->kind > PD_BIN_U32)
+			return 0;
+		off += sizeof(*sec) + pd_bin_payload_size(sec->kind, sec->count);
+	}
+
+	return off == hdr->size ? hdr->size : 0;
+}
+
+static void analysis_init(struct analysis *a, const uint8_t *snap)
+{
+	const struct pd_bin_header *hdr = (const void *)snap;
+	size_t off = sizeof(*hdr);
+	int i, k;
+
+	a->nr = hdr->nr_sections;
+	if (a->nr > MAX_SECTIONS) {
+		fprintf(stderr, "too many sections: %d\n", a->nr);
+		exit(1);
+	}
+
+	a->size = hdr->size;
+	a->ref = xcalloc(1, a->size);
+	a->prev = xcalloc(1, a->size);
+	memcpy(a->ref, snap, a->size);
+	memcpy(a->prev, snap, a->size);
+
+	for (i = 0; i < a->nr; i++) {
+		struct section_acc *s = &a->acc[i];
+		unsigned int n;
+
+		memcpy(&s->sec, snap + off, sizeof(s->sec));
+		n = s->count = s->sec.count;
+		s->off = off + sizeof(s->sec);
+		off = s->off + pd_bin_payload_size(s->sec.kind, n);
+
+		s->chg_prev = xcalloc(n, sizeof(uint32_t));
+		s->chg_ref = xcalloc(n, sizeof(uint32_t));
+		if (s->sec.kind == PD_BIN_APQ) {
+			s->out_en = xcalloc(n, sizeof(uint32_t));
+			s->high = xcalloc(n, sizeof(uint32_t));
+			s->alt_func = xcalloc(n, sizeof(uint32_t));
+			for (k = 0; k < 4; k++)
+				s->pull[k] = xcalloc(n, sizeof(uint32_t));
+		} else if (s->sec.kind == PD_BIN_PMIC) {
+			s->en = xcalloc(n, sizeof(uint32_t));
+			s->in_high = xcalloc(n, sizeof(uint32_t));
+		}
+	}
+}
+
+static int layout_matches(const struct analysis *a, const uint8_t *snap)
+{
+	const struct pd_bin_header *hdr = (const void *)snap;
+	int i;
+
+	if (hdr->size != a->size || hdr->nr_sections != a->nr)
+		return 0;
+
+	for (i = 0; i < a->nr; i++) {
+		const struct section_acc *s = &a->acc[i];
+
+		if (memcmp(snap + s->off - sizeof(s->sec), &s->sec, sizeof(s->sec)))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * The per-section loops below are branch free over contiguous arrays so
+ * that the compiler vectorizes them.
+ */
+static void acc_apq_items(unsigned int n, const uint16_t *restrict v,
+			  const uint16_t *restrict prev,
+			  const uint16_t *restrict ref,
+			  uint32_t *restrict out_en, uint32_t *restrict high,
+			  uint32_t *restrict pull_none, uint32_t *restrict pull_down,
+			  uint32_t *restrict pull_keeper, uint32_t *restrict pull_up,
+			  uint32_t *restrict alt_func, uint32_t *restrict chg_prev,
+			  uint32_t *restrict chg_ref)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t c = APQ_PACKED_CTRL(v[i]);
+		uint32_t io = APQ_PACKED_INOUT(v[i]);
+		uint32_t out = APQ_CTRL_OUT_EN(c);
+		uint32_t pull = APQ_CTRL_PULL(c);
+
+		out_en[i] += out;
+		high[i] += (out & APQ_INOUT_OUT_VAL(io)) |
+			   ((out ^ 1) & APQ_INOUT_IN_VAL(io));
+		pull_none[i] += pull == GPIOMUX_PULL_NONE;
+		pull_down[i] += pull == GPIOMUX_PULL_DOWN;
+		pull_keeper[i] += pull == GPIOMUX_PULL_KEEPER;
+		pull_up[i] += pull == GPIOMUX_PULL_UP;
+		alt_func[i] += APQ_CTRL_FUNC(c) != 0;
+		chg_prev[i] += v[i] != prev[i];
+		chg_ref[i] += v[i] != ref[i];
+	}
+}
+
+static void acc_apq(struct section_acc *s, const uint16_t *v,
+		    const uint16_t *prev, const uint16_t *ref)
+{
+	acc_apq_items(s->count, v, prev, ref, s->out_en, s->high,
+		      s->pull[GPIOMUX_PULL_NONE], s->pull[GPIOMUX_PULL_DOWN],
+		      s->pull[GPIOMUX_PULL_KEEPER], s->pull[GPIOMUX_PULL_UP],
+		      s->alt_func, s->chg_prev, s->chg_ref);
+}
+
+static void acc_pmic(struct section_acc *s, const uint8_t *restrict v,
+		     const uint8_t *restrict prev, const uint8_t *restrict ref)
+{
+	uint32_t *restrict en = s->en;
+	uint32_t *restrict in_high = s->in_high;
+	uint32_t *restrict chg_prev = s->chg_prev;
+	uint32_t *restrict chg_ref = s->chg_ref;
+	unsigned int i, n = s->count;
+
+	for (i = 0; i < n; i++) {
+		en[i] += PMIC_EN_BIT(v[i]);
+		in_high[i] += PMIC_IN_VAL(v[i]);
+		chg_prev[i] += v[i] != prev[i];
+		chg_ref[i] += v[i] != ref[i];
+	}
+}
+
+static void acc_u32(struct section_acc *s, const uint32_t *restrict v,
+		    const uint32_t *restrict prev, const uint32_t *restrict ref)
+{
+	uint32_t *restrict chg_prev = s->chg_prev;
+	uint32_t *restrict chg_ref = s->chg_ref;
+	unsigned int i, n = s->count;
+
+	for (i = 0; i < n; i++) {
+		chg_prev[i] += v[i] != prev[i];
+		chg_ref[i] += v[i] != ref[i];
+	}
+}
+
+static void analysis_add(struct analysis *a, const uint8_t *snap)
+{
+	int i;
+
+	if (!a->size)
+		analysis_init(a, snap);
+	else if (!layout_matches(a, snap)) {
+		a->mismatched++;
+		return;
+	}
+
+	for (i = 0; i < a->nr; i++) {
+		struct section_acc *s = &a->acc[i];
+		const void *v = snap + s->off;
+		const void *prev = a->prev + s->off;
+		const void *ref = a->ref + s->off;
+
+		switch (s->sec.kind) {
+		case PD_BIN_APQ:
+			acc_apq(s, v, prev, ref);
+			break;
+		case PD_BIN_PMIC:
+			acc_pmic(s, v, prev, ref);
+			break;
+		default:
+			acc_u32(s, v, prev, ref);
+			break;
+		}
+	}
+
+	memcpy(a->prev, snap, a->size);
+	a->snapshots++;
+}
+
+static double pct(uint32_t n, uint64_t total)
+{
+	return total ? 100.0 * n / total : 0.0;
+}
+
+static void analysis_print(const struct analysis *a)
+{
+	uint64_t n = a->snapshots;
+	unsigned int i;
+	int j;
+
+	printf("snapshots=%llu mismatched=%llu invalid=%llu\n",
+	       (unsigned long long)n, (unsigned long long)a->mismatched,
+	       (unsigned long long)a->invalid);
+
+	for (j = 0; j < a->nr; j++) {
+		const struct section_acc *s = &a->acc[j];
+
+		printf("[%.12s]\n", s->sec.name);
+		switch (s->sec.kind) {
+		case PD_BIN_APQ:
+			printf("#    out%%   high%%  none%%  pd%%    keep%%  pu%%    alt%%   "
+			       "chg%%   chg_ref%%\n");
+			for (i = 0; i < s->count; i++)
+				printf("%03u %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f\n",
+				       i, pct(s->out_en[i], n), pct(s->high[i], n),
+				       pct(s->pull[GPIOMUX_PULL_NONE][i], n),
+				       pct(s->pull[GPIOMUX_PULL_DOWN][i], n),
+				       pct(s->pull[GPIOMUX_PULL_KEEPER][i], n),
+				       pct(s->pull[GPIOMUX_PULL_UP][i], n),
+				       pct(s->alt_func[i], n), pct(s->chg_prev[i], n),
+				       pct(s->chg_ref[i], n));
+			break;
+		case PD_BIN_PMIC:
+			printf("#    en%%    in_high%% chg%%   chg_ref%%\n");
+			for (i = 0; i < s->count; i++)
+				printf("%03u %6.2f %6.2f   %6.2f %6.2f\n", i,
+				       pct(s->en[i], n), pct(s->in_high[i], n),
+				       pct(s->chg_prev[i], n), pct(s->chg_ref[i], n));
+			break;
+		default:
+			printf("#    chg%%   chg_ref%%\n");
+			for (i = 0; i < s->count; i++)
+				printf("%03u %6.2f %6.2f\n", i, pct(s->chg_prev[i], n),
+				       pct(s->chg_ref[i], n));
+			break;
+		}
+	}
+}
+
+static void snapshot_print(const uint8_t *snap)
+{
+	const struct pd_bin_header *hdr = (const void *)snap;
+	size_t off = sizeof(*hdr);
+	unsigned int i, j;
+
+	printf("generation=%u timestamp=%llu\n", hdr->generation,
+	       (unsigned long long)hdr->timestamp_ns);
+
+	for (j = 0; j < hdr->nr_sections; j++) {
+		const struct pd_bin_section *sec = (const void *)(snap + off);
+		const uint8_t *p = snap + off + sizeof(*sec);
+
+		printf("[%.12s]\n", sec->name);
+		for (i = 0; i < sec->count; i++) {
+			if (sec->kind == PD_BIN_APQ) {
+				uint16_t v = ((const uint16_t *)p)[i];
+				unsigned int c = APQ_PACKED_CTRL(v);
+				unsigned int io = APQ_PACKED_INOUT(v);
+
+				printf("|%03u|%-5s|%-5u|%-2umA |%-6u|%-6s|\n", i,
+				       APQ_CTRL_OUT_EN(c) ? "out" : "in",
+				       APQ_CTRL_OUT_EN(c) ? APQ_INOUT_OUT_VAL(io) :
+				       APQ_INOUT_IN_VAL(io),
+				       APQ_CTRL_DRV(c) * 2 + 2, APQ_CTRL_FUNC(c),
+				       apq_pull_map[APQ_CTRL_PULL(c)]);
+			} else if (sec->kind == PD_BIN_PMIC) {
+				printf("|%03u| value=0x%02x | en=%u | in=%u\n", i, p[i],
+				       PMIC_EN_BIT(p[i]), PMIC_IN_VAL(p[i]));
+			} else {
+				printf("|%03u| value=0x%08x\n", i,
+				       ((const uint32_t *)p)[i]);
+			}
+		}
+		off += sizeof(*sec) + pd_bin_payload_size(sec->kind, sec->count);
+	}
+}
+
+/* Consume every complete snapshot in buf, return the bytes consumed */
+static size_t process(struct analysis *a, enum mode mode, const uint8_t *buf,
+		      size_t len, int eof)
+{
+	size_t off = 0;
+	uint32_t size;
+
+	while (off + sizeof(struct pd_bin_header) <= len) {
+		const struct pd_bin_header *hdr = (const void *)(buf + off);
+
+		if (hdr->magic == PD_BIN_MAGIC && hdr->size > len - off && !eof)
+			break;
+
+		size = snapshot_check(buf + off, len - off);
+		if (!size) {
+			/* resynchronize on the next word */
+			a->invalid++;
+			off += 4;
+			continue;
+		}
+
+		if (mode == MODE_DECODE)
+			snapshot_print(buf + off);
+		else
+			analysis_add(a, buf + off);
+		off += size;
+	}
+
+	return off;
+}
+
+static int process_stream(struct analysis *a, enum mode mode, int fd)
+{
+	uint8_t *buf = NULL;
+	size_t cap = 0, len = 0, done;
+	ssize_t n;
+
+	for (;;) {
+		if (cap - len < STREAM_CHUNK) {
+			cap = cap ? cap * 2 : 4 * STREAM_CHUNK;
+			buf = realloc(buf, cap);
+			if (!buf) {
+				perror("realloc");
+				return -1;
+			}
+		}
+
+		n = read(fd, buf + len, cap - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			free(buf);
+			return -1;
+		}
+
+		len += n;
+		done = process(a, mode, buf, len, n == 0);
+		memmove(buf, buf + done, len - done);
+		len -= done;
+		if (n == 0)
+			break;
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int process_file(struct analysis *a, enum mode mode, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (!strcmp(path, "-"))
+		return process_stream(a, mode, STDIN_FILENO);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		/* pipes and special files */
+		int ret = process_stream(a, mode, fd);
+
+		close(fd);
+		return ret;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	process(a, mode, map, st.st_size, 1);
+	munmap(map, st.st_size);
+	close(fd);
+	return 0;
+}
+
+/* Synthetic snapshots laid out like the built-in SDM845 targets */
+static const struct {
+	const char *name;
+	uint8_t kind;
+	uint16_t count;
+} bench_layout[] = {
+	{ "apq_gpio", PD_BIN_APQ, 150 },
+	{ "pm845_gpio", PD_BIN_PMIC, 52 },
+	{ "pm8005_gpio", PD_BIN_PMIC, 8 },
+	{ "pm845_ldo", PD_BIN_PMIC, 44 },
+	{ "pmi8998_gpio", PD_BIN_PMIC, 28 },
+	{ "pmi8998_ldo", PD_BIN_PMIC, 1 },
+	{ "pm8005_ldo", PD_BIN_PMIC, 4 },
+};
+
+#define BENCH_POOL 4096
+
+static size_t bench_fill(uint8_t *buf, uint32_t gen, uint32_t *seed)
+{
+	struct pd_bin_header *hdr = (void *)buf;
+	size_t off = sizeof(*hdr);
+	unsigned int i, j;
+
+	for (i = 0; i < sizeof(bench_layout) / sizeof(bench_layout[0]); i++) {
+		struct pd_bin_section *sec = (void *)(buf + off);
+		uint8_t *p = buf + off + sizeof(*sec);
+
+		memset(sec, 0, sizeof(*sec));
+		sec->kind = bench_layout[i].kind;
+		sec->id = i;
+		sec->count = bench_layout[i].count;
+		memcpy(sec->name, bench_layout[i].name,
+		       strnlen(bench_layout[i].name, sizeof(sec->name)));
+		memset(p, 0, pd_bin_payload_size(sec->kind, sec->count));
+
+		for (j = 0; j < sec->count; j++) {
+			/* mostly stable state with occasional flips */
+			*seed = *seed * 1103515245 + 12345;
+			if (sec->kind == PD_BIN_APQ)
+				((uint16_t *)p)[j] = APQ_PACK(j & 0x3FF,
+					((*seed >> 16) & 0xF) == 0 ? 1 : 0);
+			else
+				p[j] = (j & 1) << 7 | (((*seed >> 16) & 0x7) == 0);
+		}
+		off += sizeof(*sec) + pd_bin_payload_size(sec->kind, sec->count);
+	}
+
+	hdr->magic = PD_BIN_MAGIC;
+	hdr->version = PD_BIN_VERSION;
+	hdr->nr_sections = i;
+	hdr->generation = gen;
+	hdr->size = off;
+	hdr->timestamp_ns = (uint64_t)gen * 1000000000ULL;
+	return off;
+}
+
+static int bench(uint64_t total)
+{
+	struct analysis a = { 0 };
+	struct timespec t0, t1;
+	uint32_t seed = 1;
+	uint8_t *pool;
+	size_t size = 0, len;
+	uint64_t done = 0;
+	double sec;
+	int i;
+
+	/* size of one snapshot */
+	pool = xcalloc(1, 4096);
+	size = bench_fill(pool, 0, &seed);
+	free(pool);
+
+	pool = xcalloc(BENCH_POOL, size);
+	for (i = 0; i < BENCH_POOL; i++)
+		bench_fill(pool + i * size, i, &seed);
+	len = (size_t)BENCH_POOL * size;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (done < total) {
+		process(&a, MODE_STATS, pool, len, 1);
+		done += BENCH_POOL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("snapshots=%llu bytes=%zu time=%.3fs rate=%.0f snapshots/s %.1f MB/s\n",
+	       (unsigned long long)a.snapshots, size, sec, a.snapshots / sec,
+	       a.snapshots * size / sec / 1e6);
+
+	free(pool);
+	return a.snapshots == done ? 0 : 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: pd_decode decode|stats FILE...\n"
+			"       pd_decode bench [N]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct analysis a = { 0 };
+	enum mode mode;
+	int i, ret = 0;
+
+	if (argc < 2)
+		usage();
+
+	if (!strcmp(argv[1], "bench"))
+		return bench(argc > 2 ? strtoull(argv[2], NULL, 0) : 1000000);
+
+	if (!strcmp(argv[1], "decode"))
+		mode = MODE_DECODE;
+	else if (!strcmp(argv[1], "stats"))
+		mode = MODE_STATS;
+	else
+		usage();
+
+	if (argc < 3)
+		usage();
+
+	for (i = 2; i < argc; i++)
+		if (process_file(&a, mode, argv[i]))
+			ret = 1;
+
+	if (mode == MODE_STATS)
+		analysis_print(&a);
+
+	return ret;
+}